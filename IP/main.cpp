@@ -5,6 +5,7 @@
 #include <chrono>
 #include <omp.h>
 #include <sciplot/sciplot.hpp>
+#include "trace.hpp"
 using namespace sciplot;
 
 const double max_x = 10.0;
@@ -93,6 +94,7 @@ double atstumo_kaina_parduotuve_artimiausio_miesto_ribos_tasko(double x1, double
 
 double tikslas(std::vector<double> x_n, std::vector<double> y_n, std::vector<double> x_m, std::vector<double> y_m)
 {
+    TRACE_SPAN("tikslas");
     double tikslas = 0.0;
 
 #pragma omp parallel for reduction(+ : tikslas)
@@ -149,6 +151,7 @@ double linalg_norm(std::vector<double> &x, std::vector<double> &y)
 
 std::pair<std::vector<double>, std::vector<double>> gradient(std::vector<double> &x_m, std::vector<double> &y_m, std::vector<double> &x_n, std::vector<double> &y_n, double h)
 {
+    TRACE_SPAN("gradient");
     std::vector<double> gx(m, 0.0);
     std::vector<double> gy(m, 0.0);
 
@@ -303,11 +306,21 @@ void chooseDataSet(const int &dataSet)
     }
 }
 
-int main()
+// IP [data set 1-8] [threads] - data set 8 on 10 threads by default
+int main(int argc, char *argv[])
 {
-    chooseDataSet(8);
+    trace::enable_from_env();
+    TRACE_THREAD_NAME("main");
+    const int dataSet = argc > 1 ? std::stoi(argv[1]) : 8;
+    const int numThreads = argc > 2 ? std::stoi(argv[2]) : 10;
+    if (numThreads < 1)
+    {
+        std::cerr << "The thread count has to be at least 1." << std::endl;
+        return 1;
+    }
+    chooseDataSet(dataSet);
     omp_set_dynamic(0);
-    omp_set_num_threads(10);
+    omp_set_num_threads(numThreads);
 
     drawPlotAndShow("Pradines_koordinates_n" + std::to_string(n) + "_m" + std::to_string(m), 750, 10, x_n, y_n, x_m, y_m);
 
@@ -322,6 +335,7 @@ int main()
 
     for (int i = 0; i < max_iter; i++)
     {
+        TRACE_SPAN("iteration");
         std::pair<std::vector<double>, std::vector<double>> grad = gradient(x_m, y_m, x_n, y_n, h);
 
         std::vector<double> x_m_h = x_m;
@@ -344,6 +358,7 @@ int main()
 
         if (tikslo_reiksme > prev_tikslo_reiksme)
         {
+            TRACE_SPAN("line search");
             // reset to previous values
             while (tikslo_reiksme > prev_tikslo_reiksme)
             {
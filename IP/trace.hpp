@@ -0,0 +1,216 @@
+#pragma once
+
+// Lightweight span tracing that writes Chrome Trace Event JSON, viewable in
+// chrome://tracing or https://ui.perfetto.dev.
+//
+// Tracing is off until trace::enable() (or trace::enable_from_env(), which
+// reads the TRACE_FILE environment variable) is called; a disabled span costs a
+// single relaxed atomic load. Compiling with -DDISABLE_TRACING removes the
+// macros entirely. Events go into per-thread buffers and are written out when
+// the program exits.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace trace
+{
+	struct Event
+	{
+		const char *name; // must point to a string literal
+		double ts_us;
+		char phase; // 'B' - begin, 'E' - end
+	};
+
+	struct ThreadBuffer
+	{
+		int tid;
+		std::string thread_name;
+		std::vector<Event> events;
+		std::uint64_t dropped = 0;
+		std::uint64_t dropped_open = 0;
+	};
+
+	// a single thread keeps at most this many events, the rest are counted as dropped
+	constexpr std::size_t max_events_per_thread = 1 << 20;
+
+	class Tracer
+	{
+	public:
+		static Tracer &instance()
+		{
+			static Tracer tracer;
+			return tracer;
+		}
+
+		bool enabled() const
+		{
+			return is_enabled.load(std::memory_order_relaxed);
+		}
+
+		void enable(const std::string &file_name)
+		{
+			std::lock_guard<std::mutex> lock(registry_mtx);
+			output_file_name = file_name;
+			if (!is_enabled.exchange(true))
+				std::atexit([]
+							{ Tracer::instance().write(); });
+		}
+
+		double now_us() const
+		{
+			return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		ThreadBuffer &thread_buffer()
+		{
+			thread_local ThreadBuffer *buffer = nullptr;
+			if (buffer == nullptr)
+			{
+				std::lock_guard<std::mutex> lock(registry_mtx);
+				buffers.push_back(std::make_unique<ThreadBuffer>());
+				buffer = buffers.back().get();
+				buffer->tid = buffers.size();
+				buffer->events.reserve(1024);
+			}
+			return *buffer;
+		}
+
+		void record(const char *name, char phase)
+		{
+			ThreadBuffer &buffer = thread_buffer();
+			// spans nest per thread, so once the buffer is full every begin is dropped
+			// and the matching ends are dropped too, keeping the pairs balanced
+			if (phase == 'B' && buffer.events.size() >= max_events_per_thread)
+			{
+				buffer.dropped++;
+				buffer.dropped_open++;
+				return;
+			}
+			if (phase == 'E' && buffer.dropped_open > 0)
+			{
+				buffer.dropped_open--;
+				return;
+			}
+			buffer.events.push_back({name, now_us(), phase});
+		}
+
+		void write()
+		{
+			std::lock_guard<std::mutex> lock(registry_mtx);
+			std::ofstream o(output_file_name);
+			if (!o.is_open())
+			{
+				std::cerr << "Failed to open '" << output_file_name << "' for the trace." << std::endl;
+				return;
+			}
+
+			o << "{\"traceEvents\":[\n";
+			bool first = true;
+			for (auto &buffer : buffers)
+			{
+				if (!buffer->thread_name.empty())
+				{
+					o << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+					  << ",\"args\":{\"name\":\"" << buffer->thread_name << "\"}}";
+					first = false;
+				}
+				for (auto &e : buffer->events)
+				{
+					o << (first ? "" : ",\n") << "{\"name\":\"" << e.name << "\",\"ph\":\"" << e.phase << "\",\"ts\":" << std::fixed << e.ts_us
+					  << std::defaultfloat << ",\"pid\":1,\"tid\":" << buffer->tid << "}";
+					first = false;
+				}
+				if (buffer->dropped > 0)
+					std::cerr << "trace: thread " << buffer->tid << " dropped " << buffer->dropped << " spans (buffer full)." << std::endl;
+			}
+			o << "\n]}\n";
+			std::cout << "Trace written to '" << output_file_name << "'." << std::endl;
+		}
+
+	private:
+		Tracer()
+		{
+			start = std::chrono::steady_clock::now();
+		}
+
+		std::atomic<bool> is_enabled{false};
+		std::chrono::steady_clock::time_point start;
+		std::mutex registry_mtx;
+		std::vector<std::unique_ptr<ThreadBuffer>> buffers; // owned here so events outlive their threads
+		std::string output_file_name;
+	};
+
+	inline void enable(const std::string &file_name)
+	{
+		Tracer::instance().enable(file_name);
+	}
+
+	// Enables tracing if the TRACE_FILE environment variable is set and tracing
+	// was not already enabled explicitly.
+	inline void enable_from_env()
+	{
+		const char *file_name = std::getenv("TRACE_FILE");
+		if (file_name != nullptr && file_name[0] != '\0' && !Tracer::instance().enabled())
+			enable(file_name);
+	}
+
+	inline void set_thread_name(const std::string &name)
+	{
+		if (Tracer::instance().enabled())
+			Tracer::instance().thread_buffer().thread_name = name;
+	}
+
+	inline void begin(const char *name)
+	{
+		if (Tracer::instance().enabled())
+			Tracer::instance().record(name, 'B');
+	}
+
+	inline void end(const char *name)
+	{
+		if (Tracer::instance().enabled())
+			Tracer::instance().record(name, 'E');
+	}
+
+	// Records a begin event on construction and the matching end event on destruction.
+	class Span
+	{
+	public:
+		explicit Span(const char *name) : name(name)
+		{
+			active = Tracer::instance().enabled();
+			if (active)
+				Tracer::instance().record(name, 'B');
+		}
+		~Span()
+		{
+			if (active)
+				Tracer::instance().record(name, 'E');
+		}
+		Span(const Span &) = delete;
+		Span &operator=(const Span &) = delete;
+
+	private:
+		const char *name;
+		bool active;
+	};
+}
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifdef DISABLE_TRACING
+#define TRACE_SPAN(name)
+#define TRACE_THREAD_NAME(name)
+#else
+#define TRACE_SPAN(name) trace::Span TRACE_CONCAT(trace_span_, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) trace::set_thread_name(name)
+#endif
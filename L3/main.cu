@@ -1,5 +1,6 @@
 #include <iostream>
 #include "json.hpp"
+#include "inline_string.hpp"
 #include <vector>
 #include <fstream>
 #include <cuda.h>
@@ -17,9 +18,18 @@ struct Person
 {
     int id;
     double age;
-    char name[MAX_NAME_LENGTH];
+    InlineString<MAX_NAME_LENGTH - 1> name;
 };
 
+Person person_from_json(const json &element)
+{
+    Person person;
+    element.at("id").get_to(person.id);
+    element.at("age").get_to(person.age);
+    person.name = element.at("name").get_ref<const string &>();
+    return person;
+}
+
 vector<Person> load_json_file(const string &file_name)
 {
     ifstream f(file_name);
@@ -32,19 +42,99 @@ vector<Person> load_json_file(const string &file_name)
     vector<Person> data_vector;
     for (auto &element : data)
     {
-        Person person;
-        element.at("id").get_to(person.id);
-        element.at("age").get_to(person.age);
-        string name_str = element.at("name");
-        strncpy(person.name, name_str.c_str(), MAX_NAME_LENGTH);
-        person.name[MAX_NAME_LENGTH - 1] = '\0';
-        data_vector.push_back(person);
+        data_vector.push_back(person_from_json(element));
     }
     f.close();
 
     return data_vector;
 }
 
+// JSON Lines: one person object per line
+vector<Person> load_json_lines_file(const string &file_name)
+{
+    ifstream f(file_name);
+    if (!f.is_open())
+    {
+        cerr << "Failed to open given '" << file_name << "' file." << endl;
+        return std::vector<Person>();
+    }
+    vector<Person> data_vector;
+    string line;
+    while (getline(f, line))
+    {
+        if (!line.empty())
+            data_vector.push_back(person_from_json(json::parse(line)));
+    }
+    return data_vector;
+}
+
+// Binary persons file, as written by lab1/generate_persons.cpp:
+// header "PRSN", uint32 version 1, uint64 count; records int32 id, double age, uint16 name length, name bytes
+vector<Person> load_binary_file(const string &file_name)
+{
+    ifstream f(file_name, ios::binary);
+    if (!f.is_open())
+    {
+        cerr << "Failed to open given '" << file_name << "' file." << endl;
+        return std::vector<Person>();
+    }
+    char magic[4];
+    uint32_t version;
+    uint64_t count;
+    f.read(magic, sizeof(magic));
+    f.read(reinterpret_cast<char *>(&version), sizeof(version));
+    f.read(reinterpret_cast<char *>(&count), sizeof(count));
+    if (!f || memcmp(magic, "PRSN", 4) != 0 || version != 1)
+    {
+        cerr << "'" << file_name << "' is not a persons binary file." << endl;
+        return std::vector<Person>();
+    }
+    // a record takes at least 14 bytes, check the count before allocating for it
+    const streampos records_start = f.tellg();
+    f.seekg(0, ios::end);
+    const uint64_t record_bytes = f.tellg() - records_start;
+    f.seekg(records_start);
+    if (!f || count > record_bytes / (sizeof(int32_t) + sizeof(double) + sizeof(uint16_t)))
+    {
+        cerr << "'" << file_name << "' is too short for the " << count << " records its header gives." << endl;
+        return std::vector<Person>();
+    }
+
+    vector<Person> data_vector(count);
+    string name_str;
+    for (auto &person : data_vector)
+    {
+        int32_t id;
+        uint16_t name_length;
+        f.read(reinterpret_cast<char *>(&id), sizeof(id));
+        f.read(reinterpret_cast<char *>(&person.age), sizeof(person.age));
+        f.read(reinterpret_cast<char *>(&name_length), sizeof(name_length));
+        name_str.resize(name_length);
+        f.read(&name_str[0], name_length);
+        if (!f)
+        {
+            cerr << "'" << file_name << "' is truncated." << endl;
+            return std::vector<Person>();
+        }
+        person.id = id;
+        person.name = name_str;
+    }
+    return data_vector;
+}
+
+vector<Person> load_persons_file(const string &file_name)
+{
+    auto ends_with = [&](const string &suffix)
+    {
+        return file_name.size() >= suffix.size() && file_name.compare(file_name.size() - suffix.size(), suffix.size(), suffix) == 0;
+    };
+    if (ends_with(".jsonl"))
+        return load_json_lines_file(file_name);
+    if (ends_with(".bin"))
+        return load_binary_file(file_name);
+    return load_json_file(file_name);
+}
+
 __device__ void hash_person(const Person *person, unsigned char *hash)
 {
     // printf("person name: %s, age: %f, id: %d\n", person->name, person->age, person->id);
@@ -53,7 +143,7 @@ __device__ void hash_person(const Person *person, unsigned char *hash)
         if (i < 15)
         {
             // the first 15 characters will be name hash
-            int name = (int)pow((int)person->name % 25 * i, 2);
+            int name = (int)pow((int)person->name.data() % 25 * i, 2);
             char randomChar = (char)(name % 25 + 'A');
             hash[i] = randomChar;
         }
@@ -123,11 +213,11 @@ __global__ void calculate_hashes(const Person *persons, unsigned char *result, c
     }
 }
 
-int main()
+int main(int argc, char *argv[])
 {
-    // read data
-    const string data_file_name = "data.json";
-    const vector<Person> data = load_json_file(data_file_name);
+    // read data, either the bundled data.json or a .json/.jsonl/.bin file given as the first argument
+    const string data_file_name = argc > 1 ? argv[1] : "data.json";
+    const vector<Person> data = load_persons_file(data_file_name);
     cout << "Loaded " << data.size() << " persons from '" << data_file_name << "'." << std::endl;
     const bool data_exists = data.size() > 0;
     if (!data_exists)
@@ -3,102 +3,9 @@
 #include <vector>
 #include <condition_variable>
 #include <mutex>
-/*
-	Monitorius saugo sveikuju skaici
+#include "int_monitor.hpp"
 
-*/
 using namespace std;
-class IntMonitor {
-public:
-	IntMonitor() {
-		this->initial_a = 10;
-		this->a = this->initial_a;
-		this->a_read_count = 0;
-		this->total_read_count = 0;
-		this->finished = false;
-	}
-
-	int readA(int prev_result, int thread_num) {
-		unique_lock<mutex> lock(this->mtx);
-
-		if (this->a == prev_result) {
-			return this->a;
-		}
-
-		cout << this->a << ", thread_num: " << thread_num << endl;
-
-		this->a_read_count++;
-		this->total_read_count++;
-
-		if (this->total_read_count >= 1000)
-			this->finished = true;
-
-		cv.notify_all();
-		return this->a;
-	}
-
-	int readAVector(vector<int> prev_results, int thread_num) {
-		unique_lock<mutex> lock(this->mtx);
-		
-		// check if prev_results has 'a' value
-		bool already_read = false;
-		for (auto& prev : prev_results) {
-			if (prev == this->a)
-			{
-				already_read = true;
-				break;
-			}
-		}
-
-		if (already_read) {
-			return -1;
-		}
-
-		cout << this->a << ", thread_num: " << thread_num << endl;
-
-		this->a_read_count++;
-		this->total_read_count++;
-
-		if (this->total_read_count >= 20)
-			this->finished = true;
-
-		cv.notify_all();
-		return this->a;
-	}
-
-	void writeA(int num) {
-		unique_lock<mutex> lock(this->mtx);
-		cv.wait(lock, [this] {
-			return this->a_read_count >= 2 || finished;
-			});
-
-		if (finished)
-			return;
-
-		if (a_read_count == 3) {
-			this->a = this->initial_a;
-		}
-		else {
-			this->a = num;
-		}
-
-		this->a_read_count = 0;
-		cv.notify_all();
-	}
-
-	bool isFinished() {
-		unique_lock<mutex> lock(this->mtx);
-		return finished;
-	}
-private:
-	bool finished;
-	int initial_a;
-	int a;
-	int a_read_count;
-	int total_read_count;
-	mutex mtx;
-	condition_variable cv;
-};
 
 void write_thread(IntMonitor& monitor, int startFrom) {
 
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+/*
+	Monitorius saugo sveikuju skaici
+
+*/
+class IntMonitor {
+public:
+	IntMonitor(int max_reads = 1000, bool print_reads = true) {
+		this->max_reads = max_reads;
+		this->print_reads = print_reads;
+		this->initial_a = 10;
+		this->a = this->initial_a;
+		this->a_read_count = 0;
+		this->total_read_count = 0;
+		this->finished = false;
+	}
+
+	int readA(int prev_result, int thread_num) {
+		std::unique_lock<std::mutex> lock(this->mtx);
+
+		if (this->a == prev_result) {
+			return this->a;
+		}
+
+		if (this->print_reads)
+			std::cout << this->a << ", thread_num: " << thread_num << std::endl;
+
+		this->a_read_count++;
+		this->total_read_count++;
+
+		if (this->total_read_count >= this->max_reads)
+			this->finished = true;
+
+		cv.notify_all();
+		return this->a;
+	}
+
+	// stops after read_limit reads of its own rather than max_reads
+	int readAVector(std::vector<int> prev_results, int thread_num, int read_limit = 20) {
+		std::unique_lock<std::mutex> lock(this->mtx);
+		
+		// check if prev_results has 'a' value
+		bool already_read = false;
+		for (auto& prev : prev_results) {
+			if (prev == this->a)
+			{
+				already_read = true;
+				break;
+			}
+		}
+
+		if (already_read) {
+			return -1;
+		}
+
+		if (this->print_reads)
+			std::cout << this->a << ", thread_num: " << thread_num << std::endl;
+
+		this->a_read_count++;
+		this->total_read_count++;
+
+		if (this->total_read_count >= read_limit)
+			this->finished = true;
+
+		cv.notify_all();
+		return this->a;
+	}
+
+	void writeA(int num) {
+		std::unique_lock<std::mutex> lock(this->mtx);
+		cv.wait(lock, [this] {
+			return this->a_read_count >= 2 || finished;
+			});
+
+		if (finished)
+			return;
+
+		if (a_read_count == 3) {
+			this->a = this->initial_a;
+		}
+		else {
+			this->a = num;
+		}
+
+		this->a_read_count = 0;
+		cv.notify_all();
+	}
+
+	bool isFinished() {
+		std::unique_lock<std::mutex> lock(this->mtx);
+		return finished;
+	}
+private:
+	bool finished;
+	bool print_reads;
+	int max_reads;
+	int initial_a;
+	int a;
+	int a_read_count;
+	int total_read_count;
+	std::mutex mtx;
+	std::condition_variable cv;
+};
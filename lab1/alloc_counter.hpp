@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Counts the heap allocations made through operator new (std::string,
+// std::vector, new[] and so on). The header replaces the global operator
+// new/delete, so it has to be included by exactly one translation unit of a
+// program, its main file.
+
+namespace alloc_counter
+{
+	inline std::atomic<long> allocations{0};
+	inline std::atomic<long> bytes{0};
+
+	struct Snapshot
+	{
+		long allocations;
+		long bytes;
+	};
+
+	inline Snapshot snapshot()
+	{
+		return {allocations.load(std::memory_order_relaxed), bytes.load(std::memory_order_relaxed)};
+	}
+
+	inline void *allocate(std::size_t size, std::size_t alignment)
+	{
+		allocations.fetch_add(1, std::memory_order_relaxed);
+		bytes.fetch_add(size, std::memory_order_relaxed);
+		if (size == 0)
+			size = 1;
+		void *p = alignment <= alignof(std::max_align_t) ? std::malloc(size)
+														: std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+		if (p == nullptr)
+			throw std::bad_alloc();
+		return p;
+	}
+}
+
+void *operator new(std::size_t size)
+{
+	return alloc_counter::allocate(size, 0);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+	return alloc_counter::allocate(size, (std::size_t)alignment);
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept
+{
+	std::free(p);
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+
+// Counts the blocks a resource takes from its upstream, for the allocation report.
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+	explicit CountingResource(std::pmr::memory_resource *upstream = std::pmr::new_delete_resource())
+	{
+		this->upstream = upstream;
+	}
+
+	long get_allocations() const
+	{
+		return allocations.load(std::memory_order_relaxed);
+	}
+
+	std::size_t get_bytes() const
+	{
+		return bytes.load(std::memory_order_relaxed);
+	}
+
+private:
+	void *do_allocate(std::size_t size, std::size_t alignment) override
+	{
+		allocations.fetch_add(1, std::memory_order_relaxed);
+		bytes.fetch_add(size, std::memory_order_relaxed);
+		return upstream->allocate(size, alignment);
+	}
+
+	void do_deallocate(void *p, std::size_t size, std::size_t alignment) override
+	{
+		upstream->deallocate(p, size, alignment);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+	{
+		return this == &other;
+	}
+
+	std::pmr::memory_resource *upstream;
+	std::atomic<long> allocations{0};
+	std::atomic<std::size_t> bytes{0};
+};
+
+// Makes a single-threaded resource (like monotonic_buffer_resource) shareable.
+class LockedResource : public std::pmr::memory_resource
+{
+public:
+	explicit LockedResource(std::pmr::memory_resource *upstream)
+	{
+		this->upstream = upstream;
+	}
+
+private:
+	void *do_allocate(std::size_t size, std::size_t alignment) override
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return upstream->allocate(size, alignment);
+	}
+
+	void do_deallocate(void *p, std::size_t size, std::size_t alignment) override
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		upstream->deallocate(p, size, alignment);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+	{
+		return this == &other;
+	}
+
+	std::pmr::memory_resource *upstream;
+	std::mutex mtx;
+};
+
+// Memory for everything one run produces, in a shared monotonic arena (the
+// monitors' slots, lab1-2's final top-K heap). Nothing is freed piecemeal: the
+// destructor drops all of it in one release, so containers using the arena
+// have to be destroyed first.
+class RunArena
+{
+public:
+	explicit RunArena(std::size_t initial_size = 1 << 16)
+		: global(initial_size, &counting), locked(&global)
+	{
+	}
+
+	std::pmr::memory_resource *shared()
+	{
+		return &locked;
+	}
+
+	// blocks and bytes taken from the heap so far
+	long heap_blocks() const
+	{
+		return counting.get_allocations();
+	}
+
+	std::size_t heap_bytes() const
+	{
+		return counting.get_bytes();
+	}
+
+private:
+	// destroyed bottom up: global frees every block before counting goes
+	CountingResource counting;
+	std::pmr::monotonic_buffer_resource global;
+	LockedResource locked;
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <glob.h>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// One input of a batch run and the results file written for it.
+struct BatchInput
+{
+	std::string input;
+	std::string output;
+};
+
+// Expands the --batch arguments into file names, in order: a glob pattern
+// becomes the files it matches (sorted), "@list.txt" the names or patterns
+// listed in that file one per line, anything else is taken as it is.
+inline std::vector<std::string> expand_batch_patterns(const std::vector<std::string> &patterns)
+{
+	std::vector<std::string> inputs;
+	for (auto &pattern : patterns)
+	{
+		if (!pattern.empty() && pattern[0] == '@')
+		{
+			std::ifstream list(pattern.substr(1));
+			if (!list.is_open())
+				throw std::runtime_error("Couldn't open the batch list '" + pattern.substr(1) + "'.");
+			std::vector<std::string> listed;
+			std::string line;
+			while (std::getline(list, line))
+			{
+				if (!line.empty() && line.back() == '\r')
+					line.pop_back();
+				if (!line.empty() && line[0] != '#')
+					listed.push_back(line);
+			}
+			for (auto &input : expand_batch_patterns(listed))
+				inputs.push_back(input);
+			continue;
+		}
+
+		glob_t matches;
+		if (glob(pattern.c_str(), GLOB_NOCHECK, nullptr, &matches) != 0)
+		{
+			globfree(&matches);
+			throw std::runtime_error("Couldn't expand the batch pattern '" + pattern + "'.");
+		}
+		for (size_t i = 0; i < matches.gl_pathc; i++)
+			inputs.push_back(matches.gl_pathv[i]);
+		globfree(&matches);
+	}
+	return inputs;
+}
+
+// Gives every input a results file named <stem>_<suffix>, in output_dir or
+// (if empty) next to the input. Inputs sharing a stem get _2, _3, ... so no
+// two of them write the same file.
+inline std::vector<BatchInput> plan_batch(const std::vector<std::string> &inputs, const std::string &output_dir, const std::string &suffix)
+{
+	std::vector<BatchInput> batch;
+	std::map<std::string, int> used;
+	for (auto &input : inputs)
+	{
+		const std::filesystem::path path(input);
+		const std::filesystem::path dir = output_dir.empty() ? path.parent_path() : std::filesystem::path(output_dir);
+		std::string stem = path.stem().string();
+		const int seen = used[(dir / stem).string()]++;
+		if (seen > 0)
+			stem += "_" + std::to_string(seen + 1);
+		batch.push_back({input, (dir / (stem + "_" + suffix)).string()});
+	}
+	return batch;
+}
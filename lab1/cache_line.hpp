@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+// Size of the unit the CPUs keep coherent. Data written by different threads
+// should not share one, otherwise every write steals the line from the other
+// threads' caches (false sharing).
+#ifdef __cpp_lib_hardware_interference_size
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winterference-size"
+constexpr std::size_t cache_line_size = std::hardware_destructive_interference_size;
+#pragma GCC diagnostic pop
+#else
+constexpr std::size_t cache_line_size = 64;
+#endif
+
+// A value on a cache line of its own, for per-thread slots in shared arrays.
+template <typename T>
+struct alignas(cache_line_size) CachePadded
+{
+	T value{};
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Cooperative cancellation of a run. The workers and the compute kernel poll
+// is_cancelled(); whoever may be asleep (a monitor's waiters, a channel's
+// receivers) registers a callback that wakes them up when the token is set.
+class CancellationToken
+{
+public:
+	// Keeps a callback registered for as long as it lives. Destroying it waits
+	// for the callback if it is running, so the callback may use anything that
+	// is destroyed after the registration.
+	class Registration
+	{
+	public:
+		Registration(const Registration &) = delete;
+		Registration &operator=(const Registration &) = delete;
+
+		~Registration()
+		{
+			if (id >= 0)
+				token.unregister(id);
+		}
+
+	private:
+		friend class CancellationToken;
+
+		Registration(CancellationToken &token, int id) : token(token)
+		{
+			this->id = id;
+		}
+
+		CancellationToken &token;
+		int id;
+	};
+
+	CancellationToken() = default;
+	CancellationToken(const CancellationToken &) = delete;
+	CancellationToken &operator=(const CancellationToken &) = delete;
+
+	// Sets the token and runs the registered callbacks; later calls do nothing.
+	void cancel()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (cancelled.exchange(true))
+			return;
+		for (auto &callback : callbacks)
+			callback.second();
+	}
+
+	bool is_cancelled() const
+	{
+		return cancelled.load(std::memory_order_relaxed);
+	}
+
+	// Runs callback when the token is set, or right away if it already is.
+	// The callback must not register or unregister callbacks itself.
+	Registration on_cancel(std::function<void()> callback)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		if (cancelled.load())
+		{
+			lock.unlock();
+			callback();
+			return Registration(*this, -1);
+		}
+		callbacks[next_id] = callback;
+		return Registration(*this, next_id++);
+	}
+
+private:
+	void unregister(int id)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		callbacks.erase(id);
+	}
+
+	std::atomic<bool> cancelled{false};
+	std::mutex mtx; // held while the callbacks run
+	std::map<int, std::function<void()>> callbacks;
+	int next_id = 0;
+};
+
+// Cancels the token once the deadline passes, unless stopped (or destroyed) first.
+class DeadlineWatchdog
+{
+public:
+	DeadlineWatchdog(CancellationToken &token, double seconds) : token(token)
+	{
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+		watcher = std::thread([this, deadline]
+							  {
+			std::unique_lock<std::mutex> lock(mtx);
+			if (!cv.wait_until(lock, deadline, [this]
+							   { return stopped; }))
+			{
+				expired = true;
+				lock.unlock();
+				this->token.cancel();
+			} });
+	}
+
+	DeadlineWatchdog(const DeadlineWatchdog &) = delete;
+	DeadlineWatchdog &operator=(const DeadlineWatchdog &) = delete;
+
+	~DeadlineWatchdog()
+	{
+		stop();
+	}
+
+	// The run finished in time: the deadline won't cancel anything any more.
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stopped = true;
+		}
+		cv.notify_all();
+		if (watcher.joinable())
+			watcher.join();
+	}
+
+	bool has_expired()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return expired;
+	}
+
+private:
+	CancellationToken &token;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stopped = false;
+	bool expired = false;
+	std::thread watcher;
+};
+
+// Appends the note that marks a results file as incomplete.
+inline void append_partial_marker(const std::string &file_name, long unprocessed, long total)
+{
+	std::cout << "Partial results: " << unprocessed << " of " << total << " records were not processed before the deadline." << std::endl;
+	std::ofstream o(file_name, std::ios_base::app);
+	o << "PARTIAL: the run was cancelled at its deadline, " << unprocessed << " of " << total << " records were not processed." << std::endl;
+}
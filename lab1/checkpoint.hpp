@@ -0,0 +1,301 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+#include "inline_string.hpp"
+#include "person.hpp"
+#include "person_table.hpp"
+
+// Checkpoint log: a header identifying the input, followed by one fixed-size
+// entry per completed record, in completion order. Records filtered out by id
+// are logged too, so a resumed run skips them as well. The file is only ever
+// appended to; a crash can leave at most one torn entry at the end, which a
+// resume cuts off.
+struct CheckpointHeader
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t record_count;
+	std::uint64_t fingerprint; // of the input table, see table_fingerprint
+};
+
+struct CheckpointEntry
+{
+	std::uint32_t row; // of the input table
+	std::int32_t id;
+	double age;
+	InlineString<MODIFIED_NAME_LENGTH> name;
+};
+
+static_assert(std::is_trivially_copyable_v<CheckpointHeader> && std::is_trivially_copyable_v<CheckpointEntry>,
+			  "checkpoint records are written as raw bytes");
+
+// The entry for a finished record. Every byte of it is set, the unused tail of
+// the name included, so no leftover memory ends up in the log.
+inline CheckpointEntry make_checkpoint_entry(std::uint32_t row, const PersonWithChangedData &result)
+{
+	CheckpointEntry entry;
+	std::memset(static_cast<void *>(&entry), 0, sizeof(entry));
+	entry.row = row;
+	entry.id = result.id;
+	entry.age = result.age;
+	entry.name.assign(std::string_view(result.name));
+	return entry;
+}
+
+constexpr char CHECKPOINT_MAGIC[8] = "LAB1CKP";
+constexpr std::uint32_t CHECKPOINT_VERSION = 1;
+
+// FNV-1a over every id, age and name, so a log is never resumed against other data.
+inline std::uint64_t table_fingerprint(const PersonTable &data)
+{
+	std::uint64_t hash = 14695981039346656037ULL;
+	auto mix = [&](const void *bytes, std::size_t size)
+	{
+		for (std::size_t i = 0; i < size; i++)
+		{
+			hash ^= static_cast<const unsigned char *>(bytes)[i];
+			hash *= 1099511628211ULL;
+		}
+	};
+	for (Person p : data)
+	{
+		mix(&p.id, sizeof(p.id));
+		mix(&p.age, sizeof(p.age));
+		mix(p.name.data(), p.name.size());
+	}
+	return hash;
+}
+
+// What an earlier run finished, read from its log.
+struct ResumeState
+{
+	std::vector<bool> completed;				 // by row
+	std::vector<PersonWithChangedData> results; // completed records that passed the id filter
+	long completed_count = 0;
+	std::uint64_t valid_bytes = 0; // the log up to the last whole entry, 0 if there is no usable log
+};
+
+// Reads the log at path. A missing or empty file means nothing was done yet;
+// a log of another input is an error.
+inline ResumeState load_checkpoint(const std::string &path, const PersonTable &data)
+{
+	ResumeState state;
+	state.completed.assign(data.size(), false);
+	std::ifstream in(path, std::ios::binary);
+	if (!in.is_open())
+		return state;
+
+	CheckpointHeader header;
+	if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)))
+		return state;
+	if (std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 || header.version != CHECKPOINT_VERSION)
+		throw std::runtime_error("'" + path + "' is not a checkpoint log of this program.");
+	if (header.record_count != data.size() || header.fingerprint != table_fingerprint(data))
+		throw std::runtime_error("Checkpoint log '" + path + "' was written for a different input.");
+
+	state.valid_bytes = sizeof(header);
+	CheckpointEntry entry;
+	while (in.read(reinterpret_cast<char *>(&entry), sizeof(entry)))
+	{
+		if (entry.row >= data.size())
+			throw std::runtime_error("Checkpoint log '" + path + "' has an entry for row " + std::to_string(entry.row) + ", which doesn't exist.");
+		if (entry.name.size() > entry.name.capacity())
+			throw std::runtime_error("Checkpoint log '" + path + "' has an entry for row " + std::to_string(entry.row) + " with a name of " +
+									 std::to_string(entry.name.size()) + " characters, more than an entry holds.");
+		state.valid_bytes += sizeof(entry);
+		if (state.completed[entry.row])
+			continue;
+		state.completed[entry.row] = true;
+		state.completed_count++;
+		if (entry.id < 0)
+		{
+			PersonWithChangedData result;
+			result.originalData = data[entry.row];
+			result.id = entry.id;
+			result.age = entry.age;
+			result.name = std::string_view(entry.name.data(), entry.name.size());
+			state.results.push_back(result);
+		}
+	}
+	return state;
+}
+
+struct CheckpointStats
+{
+	long records = 0;
+	long writes = 0;
+	std::uint64_t bytes = 0;
+	double record_ms = 0; // spent by the workers inside record()
+	double write_ms = 0;  // spent by the writer thread writing and syncing
+	double lifetime_ms = 0;
+};
+
+// Appends completed records to the log from a background thread. Workers only
+// copy their entry into a pending batch under a mutex; every interval the
+// writer swaps the batch out, writes it in one go and syncs it to disk.
+class CheckpointWriter
+{
+public:
+	// keep_bytes > 0 continues a log that load_checkpoint validated up to that
+	// many bytes (cutting off a torn entry); otherwise a new log is started.
+	CheckpointWriter(const std::string &path, const PersonTable &data, std::uint64_t keep_bytes = 0,
+					 std::chrono::milliseconds interval = std::chrono::milliseconds(2000))
+	{
+		start = std::chrono::steady_clock::now();
+		this->interval = interval;
+		fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+		if (fd == -1)
+			throw std::runtime_error("Couldn't open the checkpoint log '" + path + "'.");
+		if (keep_bytes > 0)
+		{
+			if (::ftruncate(fd, keep_bytes) != 0 || ::lseek(fd, 0, SEEK_END) == -1)
+				throw std::runtime_error("Couldn't continue the checkpoint log '" + path + "'.");
+		}
+		else
+		{
+			CheckpointHeader header;
+			std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+			header.version = CHECKPOINT_VERSION;
+			header.record_count = data.size();
+			header.fingerprint = table_fingerprint(data);
+			if (::ftruncate(fd, 0) != 0)
+				throw std::runtime_error("Couldn't start the checkpoint log '" + path + "'.");
+			write_all(&header, sizeof(header));
+		}
+		writer = std::thread(&CheckpointWriter::run, this);
+	}
+
+	CheckpointWriter(const CheckpointWriter &) = delete;
+	CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+
+	~CheckpointWriter()
+	{
+		close();
+	}
+
+	// Logs the finished record of the given row of the table.
+	void record(std::uint32_t row, const PersonWithChangedData &result)
+	{
+		const auto started = std::chrono::steady_clock::now();
+		const CheckpointEntry entry = make_checkpoint_entry(row, result);
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			pending.push_back(entry);
+		}
+		record_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count(),
+							std::memory_order_relaxed);
+	}
+
+	// Writes what is pending and stops the writer thread.
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if (stopping)
+				return;
+			stopping = true;
+		}
+		cv.notify_all();
+		writer.join();
+		::close(fd);
+		stats.lifetime_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// valid after close()
+	CheckpointStats get_stats() const
+	{
+		CheckpointStats result = stats;
+		result.record_ms = record_ns.load() / 1e6;
+		return result;
+	}
+
+	void print_summary(std::ostream &out) const
+	{
+		const CheckpointStats s = get_stats();
+		const double overhead = s.lifetime_ms > 0 ? 100.0 * (s.record_ms + s.write_ms) / s.lifetime_ms : 0;
+		out << "Checkpoint: " << s.records << " records, " << s.bytes << " bytes in " << s.writes << " writes; "
+			<< std::fixed << std::setprecision(3) << s.record_ms << " ms recording, " << s.write_ms << " ms writing ("
+			<< std::setprecision(2) << overhead << "% of " << std::setprecision(0) << s.lifetime_ms << " ms)." << std::defaultfloat << std::endl;
+	}
+
+private:
+	void run()
+	{
+		std::vector<CheckpointEntry> batch;
+		std::unique_lock<std::mutex> lock(mtx);
+		while (true)
+		{
+			cv.wait_for(lock, interval, [this]
+						{ return stopping; });
+			const bool last = stopping;
+			batch.swap(pending);
+			lock.unlock();
+			if (!batch.empty() && !failed)
+			{
+				const auto started = std::chrono::steady_clock::now();
+				try
+				{
+					write_all(batch.data(), batch.size() * sizeof(CheckpointEntry));
+					::fdatasync(fd);
+					stats.records += batch.size();
+				}
+				catch (const std::exception &e)
+				{
+					// the run itself can go on, it just can't be resumed from here on
+					std::cerr << e.what() << " Checkpointing stopped." << std::endl;
+					failed = true;
+				}
+				stats.write_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+			}
+			batch.clear();
+			if (last)
+				return;
+			lock.lock();
+		}
+	}
+
+	void write_all(const void *bytes, std::size_t size)
+	{
+		const char *p = static_cast<const char *>(bytes);
+		while (size > 0)
+		{
+			const ssize_t written = ::write(fd, p, size);
+			if (written < 0)
+				throw std::runtime_error("Couldn't write to the checkpoint log.");
+			p += written;
+			size -= written;
+		}
+		stats.writes++;
+		stats.bytes += p - static_cast<const char *>(bytes);
+	}
+
+	int fd;
+	std::chrono::steady_clock::time_point start;
+	std::chrono::milliseconds interval;
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::vector<CheckpointEntry> pending;
+	bool stopping = false;
+	bool failed = false; // a write failed, later batches are dropped
+	std::atomic<long> record_ns{0};
+	CheckpointStats stats; // written by the writer thread (and the constructor's header write)
+	std::thread writer;
+};
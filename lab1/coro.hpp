@@ -0,0 +1,542 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// A small C++20 coroutine runtime for the pipeline: lazily started Task<>
+// coroutines, a fixed pool of executor threads that runs them, and bounded
+// channels whose send/receive suspend the coroutine instead of blocking the
+// thread. Any number of stages can share a handful of threads; a thread only
+// sleeps when no coroutine at all is ready to run.
+namespace coro
+{
+	template <typename T = void>
+	class Task;
+
+	namespace detail
+	{
+		struct PromiseBase
+		{
+			// resumed when the task finishes: whoever co_awaited it
+			std::coroutine_handle<> continuation = std::noop_coroutine();
+			std::exception_ptr exception;
+
+			struct FinalAwaiter
+			{
+				bool await_ready() noexcept
+				{
+					return false;
+				}
+
+				template <typename Promise>
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+				{
+					return handle.promise().continuation;
+				}
+
+				void await_resume() noexcept
+				{
+				}
+			};
+
+			std::suspend_always initial_suspend() noexcept
+			{
+				return {};
+			}
+
+			FinalAwaiter final_suspend() noexcept
+			{
+				return {};
+			}
+
+			void unhandled_exception()
+			{
+				exception = std::current_exception();
+			}
+		};
+
+		template <typename T>
+		struct Promise : PromiseBase
+		{
+			std::optional<T> value;
+
+			Task<T> get_return_object();
+
+			void return_value(T value)
+			{
+				this->value = std::move(value);
+			}
+
+			T result()
+			{
+				if (exception)
+					std::rethrow_exception(exception);
+				return std::move(*value);
+			}
+		};
+
+		template <>
+		struct Promise<void> : PromiseBase
+		{
+			Task<void> get_return_object();
+
+			void return_void()
+			{
+			}
+
+			void result()
+			{
+				if (exception)
+					std::rethrow_exception(exception);
+			}
+		};
+
+		// Fire-and-forget coroutine: starts at once and frees itself when done.
+		struct Detached
+		{
+			struct promise_type
+			{
+				Detached get_return_object()
+				{
+					return {};
+				}
+
+				std::suspend_never initial_suspend() noexcept
+				{
+					return {};
+				}
+
+				std::suspend_never final_suspend() noexcept
+				{
+					return {};
+				}
+
+				void return_void()
+				{
+				}
+
+				void unhandled_exception()
+				{
+					std::terminate();
+				}
+			};
+		};
+	}
+
+	// A coroutine that starts when it is co_awaited and hands its result (or
+	// exception) to the awaiting coroutine, which continues on the same thread.
+	template <typename T>
+	class Task
+	{
+	public:
+		using promise_type = detail::Promise<T>;
+
+		explicit Task(std::coroutine_handle<promise_type> handle)
+		{
+			this->handle = handle;
+		}
+
+		Task(Task &&other) noexcept : handle(std::exchange(other.handle, nullptr))
+		{
+		}
+
+		Task &operator=(Task &&other) noexcept
+		{
+			if (this != &other)
+			{
+				if (handle)
+					handle.destroy();
+				handle = std::exchange(other.handle, nullptr);
+			}
+			return *this;
+		}
+
+		Task(const Task &) = delete;
+		Task &operator=(const Task &) = delete;
+
+		~Task()
+		{
+			if (handle)
+				handle.destroy();
+		}
+
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		// symmetric transfer: start the task right away, without growing the stack
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+		{
+			handle.promise().continuation = awaiting;
+			return handle;
+		}
+
+		T await_resume()
+		{
+			return handle.promise().result();
+		}
+
+	private:
+		std::coroutine_handle<promise_type> handle;
+	};
+
+	namespace detail
+	{
+		template <typename T>
+		Task<T> Promise<T>::get_return_object()
+		{
+			return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+		}
+
+		inline Task<void> Promise<void>::get_return_object()
+		{
+			return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+		}
+	}
+
+	// A fixed pool of threads resuming ready coroutines in FIFO order.
+	class Executor
+	{
+	public:
+		// on_thread_start runs first on every pool thread (naming, pinning, statistics)
+		explicit Executor(int thread_count, std::function<void(int)> on_thread_start = nullptr)
+		{
+			if (thread_count < 1)
+			{
+				throw std::runtime_error("An Executor needs at least 1 thread.");
+			}
+			this->on_thread_start = on_thread_start;
+			for (int i = 0; i < thread_count; i++)
+				threads.emplace_back(&Executor::run, this, i);
+		}
+
+		Executor(const Executor &) = delete;
+		Executor &operator=(const Executor &) = delete;
+
+		~Executor()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				stopping = true;
+			}
+			cv.notify_all();
+			for (auto &thread : threads)
+				thread.join();
+		}
+
+		// Queues a suspended coroutine to be resumed by one of the pool threads.
+		void post(std::coroutine_handle<> handle)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				ready.push_back(handle);
+			}
+			cv.notify_one();
+		}
+
+		// co_await executor.schedule() continues the coroutine on a pool thread
+		auto schedule()
+		{
+			struct ScheduleAwaiter
+			{
+				Executor &executor;
+
+				bool await_ready() noexcept
+				{
+					return false;
+				}
+
+				void await_suspend(std::coroutine_handle<> handle)
+				{
+					executor.post(handle);
+				}
+
+				void await_resume() noexcept
+				{
+				}
+			};
+			return ScheduleAwaiter{*this};
+		}
+
+		// Runs the task on the pool without anyone awaiting it; wait_idle waits for it.
+		void spawn(Task<> task)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				outstanding++;
+			}
+			run_detached(std::move(task));
+		}
+
+		// Blocks the calling (non-pool) thread until every spawned task has
+		// finished, then rethrows the first exception one of them ended with.
+		void wait_idle()
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			idle_cv.wait(lock, [&]
+						 { return outstanding == 0; });
+			if (failure)
+				std::rethrow_exception(std::exchange(failure, nullptr));
+		}
+
+		int thread_count() const
+		{
+			return threads.size();
+		}
+
+		// how many times a pool thread went to sleep because nothing was ready
+		long get_idle_waits() const
+		{
+			return idle_waits.load(std::memory_order_relaxed);
+		}
+
+	private:
+		detail::Detached run_detached(Task<> task)
+		{
+			co_await schedule();
+			std::exception_ptr exception;
+			try
+			{
+				co_await task;
+			}
+			catch (...)
+			{
+				exception = std::current_exception();
+			}
+			finished(exception);
+		}
+
+		void finished(std::exception_ptr exception)
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if (exception && !failure)
+				failure = exception;
+			if (--outstanding == 0)
+				idle_cv.notify_all();
+		}
+
+		void run(int index)
+		{
+			if (on_thread_start)
+				on_thread_start(index);
+			while (true)
+			{
+				std::coroutine_handle<> handle;
+				{
+					std::unique_lock<std::mutex> lock(mtx);
+					if (ready.empty() && !stopping)
+					{
+						idle_waits.fetch_add(1, std::memory_order_relaxed);
+						cv.wait(lock, [&]
+								{ return stopping || !ready.empty(); });
+					}
+					if (ready.empty())
+						return;
+					handle = ready.front();
+					ready.pop_front();
+				}
+				handle.resume();
+			}
+		}
+
+		std::function<void(int)> on_thread_start;
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::condition_variable idle_cv;
+		std::deque<std::coroutine_handle<>> ready;
+		bool stopping = false;
+		int outstanding = 0;
+		std::exception_ptr failure;
+		std::atomic<long> idle_waits{0};
+		std::vector<std::thread> threads;
+	};
+
+	// A bounded multi-producer multi-consumer queue between coroutines.
+	// co_await send(v) suspends while the buffer is full and yields false if
+	// the channel is closed, co_await receive() suspends while it is empty and
+	// yields std::nullopt once the channel is closed and drained. Suspended
+	// coroutines are resumed through the executor.
+	template <typename T>
+	class Channel
+	{
+	public:
+		class SendAwaiter
+		{
+		public:
+			SendAwaiter(Channel &channel, T value) : channel(channel), value(std::move(value))
+			{
+			}
+
+			bool await_ready() noexcept
+			{
+				return false;
+			}
+
+			bool await_suspend(std::coroutine_handle<> handle)
+			{
+				std::lock_guard<std::mutex> lock(channel.mtx);
+				if (channel.closed)
+				{
+					rejected = true;
+					return false;
+				}
+				if (!channel.receivers.empty())
+				{
+					// a receiver is waiting, so the buffer is empty: hand the value over directly
+					ReceiveAwaiter *receiver = channel.receivers.front();
+					channel.receivers.pop_front();
+					receiver->result = std::move(value);
+					channel.executor.post(receiver->handle);
+					return false;
+				}
+				if (channel.buffer.size() < channel.capacity)
+				{
+					channel.buffer.push_back(std::move(value));
+					return false;
+				}
+				this->handle = handle;
+				channel.senders.push_back(this);
+				channel.suspended_sends++;
+				return true;
+			}
+
+			// false if the channel was closed and the value dropped
+			bool await_resume() noexcept
+			{
+				return !rejected;
+			}
+
+		private:
+			friend class Channel;
+			Channel &channel;
+			T value;
+			std::coroutine_handle<> handle;
+			bool rejected = false;
+		};
+
+		class ReceiveAwaiter
+		{
+		public:
+			explicit ReceiveAwaiter(Channel &channel) : channel(channel)
+			{
+			}
+
+			bool await_ready() noexcept
+			{
+				return false;
+			}
+
+			bool await_suspend(std::coroutine_handle<> handle)
+			{
+				std::lock_guard<std::mutex> lock(channel.mtx);
+				if (!channel.buffer.empty())
+				{
+					result = std::move(channel.buffer.front());
+					channel.buffer.pop_front();
+					// the freed slot goes to the longest waiting sender
+					if (!channel.senders.empty())
+					{
+						SendAwaiter *sender = channel.senders.front();
+						channel.senders.pop_front();
+						channel.buffer.push_back(std::move(sender->value));
+						channel.executor.post(sender->handle);
+					}
+					return false;
+				}
+				if (!channel.senders.empty())
+				{
+					// unbuffered channel: take the value from the sender itself
+					SendAwaiter *sender = channel.senders.front();
+					channel.senders.pop_front();
+					result = std::move(sender->value);
+					channel.executor.post(sender->handle);
+					return false;
+				}
+				if (channel.closed)
+					return false;
+				this->handle = handle;
+				channel.receivers.push_back(this);
+				channel.suspended_receives++;
+				return true;
+			}
+
+			std::optional<T> await_resume()
+			{
+				return std::move(result);
+			}
+
+		private:
+			friend class Channel;
+			Channel &channel;
+			std::optional<T> result;
+			std::coroutine_handle<> handle;
+		};
+
+		Channel(Executor &executor, std::size_t capacity) : executor(executor)
+		{
+			this->capacity = capacity;
+		}
+
+		SendAwaiter send(T value)
+		{
+			return SendAwaiter(*this, std::move(value));
+		}
+
+		ReceiveAwaiter receive()
+		{
+			return ReceiveAwaiter(*this);
+		}
+
+		// No more sends: waiting receivers get std::nullopt, waiting and later senders false.
+		void close()
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			closed = true;
+			for (ReceiveAwaiter *receiver : receivers)
+				executor.post(receiver->handle);
+			receivers.clear();
+			for (SendAwaiter *sender : senders)
+			{
+				sender->rejected = true;
+				executor.post(sender->handle);
+			}
+			senders.clear();
+		}
+
+		// how often a send found the buffer full / a receive found it empty
+		long get_suspended_sends()
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			return suspended_sends;
+		}
+
+		long get_suspended_receives()
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			return suspended_receives;
+		}
+
+	private:
+		Executor &executor;
+		std::size_t capacity;
+		std::mutex mtx;
+		std::deque<T> buffer;
+		std::deque<SendAwaiter *> senders;
+		std::deque<ReceiveAwaiter *> receivers;
+		bool closed = false;
+		long suspended_sends = 0;
+		long suspended_receives = 0;
+	};
+}
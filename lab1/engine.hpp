@@ -0,0 +1,413 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "cache_line.hpp"
+#include "cancellation.hpp"
+#include "monitors.hpp"
+#include "person.hpp"
+#include "person_table.hpp"
+#include "radix_sort.hpp"
+#include "work_stealing.hpp"
+
+// The code lab1 and lab1-2 share: the compute kernel, the results files and
+// the engine that runs the kernel over a table on a selectable backend.
+
+inline void save_persons_table(const PersonTable &data, const std::string &file_name, const std::string &title, const bool &append)
+{
+	std::cout << "saving " << data.size() << " persons.\n";
+
+	std::ofstream o;
+	if (append)
+		o.open(file_name, std::ios_base::app);
+	else
+		o.open(file_name);
+
+	if (data.size() > 0)
+	{
+		o << "_________________________________________________________" << std::endl;
+		o << "| " << std::setw(52) << title << " |" << std::endl;
+		o << "|-------------------------------------------------------|" << std::endl;
+		o << "| ID          | Name                           | Age    |" << std::endl;
+		o << "|-------------------------------------------------------|" << std::endl;
+		for (Person p : data)
+		{
+			o << "| " << std::setw(11) << p.id << " | " << std::setw(30) << p.name << " | " << std::setw(6) << p.age << " |" << std::endl;
+		}
+		o << "|-------------------------------------------------------|" << std::endl;
+		o << std::endl;
+	}
+	else
+	{
+		o << "No people's data. Either there was no data to begin with, or all of it was filtered." << std::endl;
+	}
+	o.close();
+}
+
+// The sums lab1-2 writes under its results table.
+struct ResultSums
+{
+	int id_sum = 0;
+	double age_sum = 0;
+};
+
+// sums - written under the table if given, otherwise the table ends with an empty line
+inline void save_modified_persons_table(const std::vector<PersonWithChangedData> &data, const std::string &file_name, const std::string &title, const bool &append,
+										const ResultSums *sums = nullptr)
+{
+	std::cout << "saving " << data.size() << " modified persons.\n";
+
+	std::ofstream o;
+	if (append)
+		o.open(file_name, std::ios_base::app);
+	else
+		o.open(file_name);
+
+	if (data.size() > 0)
+	{
+		o << "_________________________________________________________" << std::endl;
+		o << "| " << std::setw(52) << title << " |" << std::endl;
+		o << "|-------------------------------------------------------|" << std::endl;
+		o << "| ID          | Name                           | Age    |" << std::endl;
+		o << "|-------------------------------------------------------|" << std::endl;
+		for (auto &p : data)
+		{
+			o << "| " << std::setw(11) << p.id << " | " << std::setw(30) << p.name << " | " << std::setw(6) << p.age << " |" << std::endl;
+		}
+		o << "|-------------------------------------------------------|" << std::endl;
+		if (sums != nullptr)
+		{
+			o << "ID sum: " << sums->id_sum << std::endl;
+			o << "Age sum: " << sums->age_sum << std::endl;
+		}
+		else
+			o << std::endl;
+	}
+	else
+	{
+		o << "No modified people's data. Either there was no data to begin with, or all of it was filtered." << std::endl;
+	}
+	o.close();
+}
+
+inline void save_modified_persons_table(const std::vector<PersonWithChangedData> &data, const std::string &file_name, const std::string &title, const bool &append,
+										const int &id_sum, const double &age_sum)
+{
+	const ResultSums sums{id_sum, age_sum};
+	save_modified_persons_table(data, file_name, title, append, &sums);
+}
+
+// Generate a new name with very complex calculations
+inline InlineString<MODIFIED_NAME_LENGTH> modified_name(const Person &person)
+{
+	InlineString<MODIFIED_NAME_LENGTH> name;
+	for (int i = 0; i < 10; i++)
+	{
+		char randomChar = (char)((int)pow(person.id + i, 4) % 25 + 'A'); // Generate 'A' to 'Z'
+		name += randomChar;
+		for (int j = 0; j < 2; j++)
+		{
+			randomChar = (char)((int)pow(person.age + i * j, 5) % 25 + 'A'); // Generate 'A' to 'Z'
+			name += randomChar;
+		}
+	}
+	return name;
+}
+
+// Returns std::nullopt if the token is cancelled before the computation is done.
+// The outer loops run in blocks of CANCEL_CHECK_INTERVAL iterations and the
+// token is polled between blocks, which leaves the loop bodies as they were.
+constexpr int CANCEL_CHECK_INTERVAL = 1024;
+inline std::optional<PersonWithChangedData> modify_person_data(const Person &person, const CancellationToken &cancel)
+{
+	PersonWithChangedData p;
+	p.originalData = person;
+
+	// Generate a new id with very complex calculations
+	p.id = 0;
+	for (int block = 0; block < 1000000; block += CANCEL_CHECK_INTERVAL)
+	{
+		if (cancel.is_cancelled())
+			return std::nullopt;
+		for (int i = block; i < std::min(block + CANCEL_CHECK_INTERVAL, 1000000); i++)
+		{
+			p.id += person.id * i;
+			for (int j = 0; j < 100; j++)
+			{
+				p.id += i * j;
+			}
+		}
+	}
+	p.id /= 100000000;
+
+	// Generate a new age with very complex calculations
+	p.age = person.age;
+	for (int block = 0; block < 1000000; block += CANCEL_CHECK_INTERVAL)
+	{
+		if (cancel.is_cancelled())
+			return std::nullopt;
+		for (int i = block; i < std::min(block + CANCEL_CHECK_INTERVAL, 1000000); i++)
+		{
+			if (p.age < 0)
+				p.age += -p.age * 3.1425;
+			else
+				p.age += p.age * 3.1425;
+			for (int j = 0; j < 100; j++)
+			{
+				p.age += i + j;
+			}
+			if (p.age < 0 || p.age > 10000)
+			{
+				p.age = person.age;
+			}
+		}
+	}
+
+	p.name = modified_name(person);
+	return p;
+}
+
+// How the engine spreads the records over its threads.
+enum class Backend
+{
+	Serial,		 // the calling thread alone
+	Threads,	 // a producer thread feeding worker threads through a DataMonitor, results in a SortedResultMonitor
+	OmpStatic,	 // omp parallel for, schedule(static)
+	OmpDynamic,	 // omp parallel for, schedule(dynamic, 1)
+	OmpGuided,	 // omp parallel for, schedule(guided)
+	WorkStealing // per-thread ranges, idle threads steal half of the largest one
+};
+
+const std::vector<Backend> ALL_BACKENDS = {Backend::Serial, Backend::Threads, Backend::OmpStatic, Backend::OmpDynamic, Backend::OmpGuided, Backend::WorkStealing};
+
+inline bool parse_backend(const std::string &name, Backend &backend)
+{
+	if (name == "serial")
+		backend = Backend::Serial;
+	else if (name == "threads")
+		backend = Backend::Threads;
+	else if (name == "omp-static")
+		backend = Backend::OmpStatic;
+	else if (name == "omp-dynamic")
+		backend = Backend::OmpDynamic;
+	else if (name == "omp-guided")
+		backend = Backend::OmpGuided;
+	else if (name == "work-stealing")
+		backend = Backend::WorkStealing;
+	else
+		return false;
+	return true;
+}
+
+inline std::string backend_name(Backend backend)
+{
+	switch (backend)
+	{
+	case Backend::Serial:
+		return "serial";
+	case Backend::Threads:
+		return "threads";
+	case Backend::OmpStatic:
+		return "omp-static";
+	case Backend::OmpDynamic:
+		return "omp-dynamic";
+	case Backend::OmpGuided:
+		return "omp-guided";
+	case Backend::WorkStealing:
+		return "work-stealing";
+	}
+	return "unknown";
+}
+
+// The OpenMP backends exist only in programs built with -fopenmp.
+inline bool backend_available([[maybe_unused]] Backend backend)
+{
+#ifdef _OPENMP
+	return true;
+#else
+	return backend != Backend::OmpStatic && backend != Backend::OmpDynamic && backend != Backend::OmpGuided;
+#endif
+}
+
+struct EngineResult
+{
+	std::vector<PersonWithChangedData> results; // the ones with a negative id, youngest first
+	ResultSums sums;
+	double elapsed_ms = 0;
+	int threads = 1;
+	long steals = 0; // work-stealing only
+};
+
+namespace engine_detail
+{
+	// Every thread collects its results in a slot of its own; they are joined at the end.
+	using ResultSlots = std::vector<CachePadded<std::vector<PersonWithChangedData>>>;
+
+	inline void process(const Person &person, std::vector<PersonWithChangedData> &results, const CancellationToken &cancel)
+	{
+		std::optional<PersonWithChangedData> p_changed = modify_person_data(person, cancel);
+		if (p_changed && p_changed->id < 0)
+			results.push_back(*p_changed);
+	}
+
+	inline void run_threads(const PersonTable &data, int threads, std::vector<PersonWithChangedData> &results, const CancellationToken &cancel)
+	{
+		bool data_exists = data.size() > 0;
+		DataMonitor data_monitor(data, std::max(1, 2 * threads), data_exists);
+		SortedResultMonitor sorted_monitor(data.size(), nullptr, WaitMode::Block, std::pmr::get_default_resource(), 0, SortMethod::Std);
+		std::vector<std::thread> workers;
+		for (int t = 0; t < threads; t++)
+			workers.emplace_back([&]
+								 {
+				while (std::optional<QueuedPerson> item = data_monitor.removeItem())
+				{
+					std::optional<PersonWithChangedData> p_changed = modify_person_data(item->person, cancel);
+					if (p_changed && p_changed->id < 0)
+						sorted_monitor.addItemSorted(*p_changed);
+				} });
+		for (std::size_t row = 0; row < data.size(); row++)
+			data_monitor.addItem(row);
+		data_monitor.notify_workers_no_data();
+		for (auto &worker : workers)
+			worker.join();
+		results = sorted_monitor.getItems();
+	}
+
+#ifdef _OPENMP
+	inline void run_openmp(const PersonTable &data, Backend backend, int threads, ResultSlots &slots, const CancellationToken &cancel)
+	{
+		const long count = data.size();
+		// schedule(runtime) would make the kind depend on OMP_SCHEDULE, so every kind has its own loop
+		if (backend == Backend::OmpStatic)
+		{
+#pragma omp parallel for schedule(static) num_threads(threads)
+			for (long i = 0; i < count; i++)
+				process(data[i], slots[omp_get_thread_num()].value, cancel);
+		}
+		else if (backend == Backend::OmpDynamic)
+		{
+#pragma omp parallel for schedule(dynamic, 1) num_threads(threads)
+			for (long i = 0; i < count; i++)
+				process(data[i], slots[omp_get_thread_num()].value, cancel);
+		}
+		else
+		{
+#pragma omp parallel for schedule(guided) num_threads(threads)
+			for (long i = 0; i < count; i++)
+				process(data[i], slots[omp_get_thread_num()].value, cancel);
+		}
+	}
+#endif
+}
+
+// Runs the kernel over every record of the table on the given backend and
+// returns the results in age order, so every backend's output is the same.
+// The serial backend always uses one thread.
+inline EngineResult run_engine(const PersonTable &data, Backend backend, int threads)
+{
+	if (!backend_available(backend))
+		throw std::runtime_error("The " + backend_name(backend) + " backend needs a program built with -fopenmp.");
+	EngineResult result;
+	result.threads = backend == Backend::Serial ? 1 : std::max(1, threads);
+	const CancellationToken never_cancelled;
+	engine_detail::ResultSlots slots(result.threads);
+
+	const auto started = std::chrono::steady_clock::now();
+	switch (backend)
+	{
+	case Backend::Serial:
+		for (Person p : data)
+			engine_detail::process(p, slots[0].value, never_cancelled);
+		break;
+	case Backend::Threads:
+		engine_detail::run_threads(data, result.threads, slots[0].value, never_cancelled);
+		break;
+	case Backend::WorkStealing:
+		result.steals = work_stealing_for(result.threads, data.size(), [&](int thread, std::size_t i)
+										  { engine_detail::process(data[i], slots[thread].value, never_cancelled); });
+		break;
+	default:
+#ifdef _OPENMP
+		engine_detail::run_openmp(data, backend, result.threads, slots, never_cancelled);
+#endif
+		break;
+	}
+	for (auto &slot : slots)
+		result.results.insert(result.results.end(), slot.value.begin(), slot.value.end());
+	sort_results(result.results, SortMethod::Std);
+	result.elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+
+	// summed in age order, so the sums don't depend on which thread finished first
+	for (auto &p : result.results)
+	{
+		result.sums.id_sum += p.id;
+		result.sums.age_sum += p.age;
+	}
+	return result;
+}
+
+inline bool same_results(const std::vector<PersonWithChangedData> &a, const std::vector<PersonWithChangedData> &b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (std::size_t i = 0; i < a.size(); i++)
+		if (a[i].id != b[i].id || a[i].age != b[i].age || a[i].name != b[i].name)
+			return false;
+	return true;
+}
+
+// --compare: runs the table on every backend the program has, the serial one
+// first as the baseline, and prints each one's speedup over it and its
+// efficiency (speedup per thread). Returns false if a backend's results
+// differ from the serial ones.
+inline bool compare_backends(const PersonTable &data, int threads, std::ostream &out)
+{
+	std::vector<Backend> backends;
+	for (Backend backend : ALL_BACKENDS)
+		if (backend_available(backend))
+			backends.push_back(backend);
+
+	std::vector<EngineResult> runs;
+	for (Backend backend : backends)
+	{
+		out << "Running the " << backend_name(backend) << " backend..." << std::endl;
+		runs.push_back(run_engine(data, backend, threads));
+	}
+
+	bool all_match = true;
+	const double serial_ms = runs[0].elapsed_ms;
+	out << "Backend comparison: " << data.size() << " records, " << threads << " threads." << std::endl;
+	out << "| Backend       | Threads |    Time ms | Speedup | Efficiency | Results        |" << std::endl;
+	out << "|---------------|---------|------------|---------|------------|----------------|" << std::endl;
+	for (std::size_t i = 0; i < runs.size(); i++)
+	{
+		const EngineResult &run = runs[i];
+		const double speedup = run.elapsed_ms > 0 ? serial_ms / run.elapsed_ms : 0;
+		const bool match = same_results(run.results, runs[0].results);
+		all_match = all_match && match;
+		out << "| " << std::left << std::setw(13) << backend_name(backends[i]) << std::right << " | " << std::setw(7) << run.threads << " | "
+			<< std::fixed << std::setprecision(1) << std::setw(10) << run.elapsed_ms << " | " << std::setprecision(2) << std::setw(7) << speedup << " | "
+			<< std::setprecision(1) << std::setw(9) << 100.0 * speedup / run.threads << "% | " << std::setw(6) << run.results.size() << " "
+			<< std::left << std::setw(7) << (match ? "same" : "DIFFER") << std::right << " |" << std::defaultfloat << std::endl;
+	}
+	for (std::size_t i = 0; i < runs.size(); i++)
+		if (backends[i] == Backend::WorkStealing)
+			out << "Work-stealing: " << runs[i].steals << " steals." << std::endl;
+	if (!all_match)
+		out << "Some backends' results differ from the serial ones." << std::endl;
+	return all_match;
+}
@@ -0,0 +1,280 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "cache_line.hpp"
+#include "topology.hpp"
+
+// Measures what false sharing costs on this machine: every thread updates its
+// own slot of a shared array, once with the slots packed next to each other
+// (the old layout of the lab1-2 sums and the ThreadStats deque) and once with
+// every slot on its own cache line (CachePadded). Cache misses are read from the
+// hardware performance counters (perf_event_open); when those are unavailable,
+// for example in containers or with a high perf_event_paranoid, only the times
+// are reported.
+
+struct BenchmarkConfig
+{
+	int max_threads = std::max(2u, std::thread::hardware_concurrency());
+	long iterations = 10000000;
+	std::string csv_file_name = "false_sharing_benchmark.csv";
+};
+
+struct BenchmarkResult
+{
+	std::string workload;
+	std::string layout;
+	int threads;
+	double seconds;
+	long long l1d_misses; // -1 when the counter is unavailable
+	long long cache_misses;
+};
+
+// The lab1-2 per-thread sums, without padding.
+struct Sums
+{
+	int id_sum = 0;
+	double age_sum = 0;
+};
+
+class PerfCounter
+{
+public:
+	PerfCounter(std::uint32_t type, std::uint64_t config)
+	{
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		// counts the calling thread on whatever CPU it runs
+		fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (fd == -1)
+			error = std::strerror(errno);
+	}
+	~PerfCounter()
+	{
+		if (fd != -1)
+			close(fd);
+	}
+	PerfCounter(const PerfCounter &) = delete;
+	PerfCounter &operator=(const PerfCounter &) = delete;
+
+	void start()
+	{
+		if (fd != -1)
+		{
+			ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+
+	// Stops counting and returns the count, -1 if the counter couldn't be opened.
+	long long stop()
+	{
+		if (fd == -1)
+			return -1;
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		long long count = 0;
+		if (read(fd, &count, sizeof(count)) != sizeof(count))
+			return -1;
+		return count;
+	}
+
+	bool available() const
+	{
+		return fd != -1;
+	}
+
+	const std::string &get_error() const
+	{
+		return error;
+	}
+
+private:
+	int fd = -1;
+	std::string error;
+};
+
+constexpr std::uint64_t L1D_READ_MISS = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+// -1 if any thread couldn't read the counter
+long long sum_counts(const std::vector<long long> &counts)
+{
+	long long total = 0;
+	for (long long count : counts)
+	{
+		if (count < 0)
+			return -1;
+		total += count;
+	}
+	return total;
+}
+
+// Runs update(slot index, iteration) `iterations` times on each of `threads` threads, every
+// thread pinned to its own core where possible, and sums up their counters.
+template <typename Update>
+BenchmarkResult run(const std::string &workload, const std::string &layout, int threads, long iterations, const PlacementPlan &plan, Update update)
+{
+	std::vector<long long> l1d_misses(threads), cache_misses(threads);
+	std::atomic<int> ready{0};
+	std::atomic<bool> go{false};
+
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++)
+	{
+		workers.emplace_back([&, t]
+							 {
+			pin_current_thread(plan.worker_cpus.empty() ? -1 : plan.worker_cpus[t]);
+			PerfCounter l1d(PERF_TYPE_HW_CACHE, L1D_READ_MISS);
+			PerfCounter llc(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+			// start together, otherwise the first threads finish before the last ones begin
+			ready++;
+			while (!go.load())
+				std::this_thread::yield();
+			l1d.start();
+			llc.start();
+			for (long i = 0; i < iterations; i++)
+				update(t, i);
+			l1d_misses[t] = l1d.stop();
+			cache_misses[t] = llc.stop(); });
+	}
+	while (ready.load() < threads)
+		std::this_thread::yield();
+	const auto start = std::chrono::steady_clock::now();
+	go = true;
+	for (auto &worker : workers)
+		worker.join();
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return {workload, layout, threads, seconds, sum_counts(l1d_misses), sum_counts(cache_misses)};
+}
+
+std::vector<BenchmarkResult> run_counters(int threads, long iterations, const PlacementPlan &plan)
+{
+	std::vector<BenchmarkResult> results;
+	{
+		std::vector<std::atomic<long>> slots(threads);
+		results.push_back(run("counter", "packed", threads, iterations, plan, [&](int t, long)
+							  { slots[t].store(slots[t].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }));
+	}
+	{
+		std::vector<CachePadded<std::atomic<long>>> slots(threads);
+		results.push_back(run("counter", "padded", threads, iterations, plan, [&](int t, long)
+							  { slots[t].value.store(slots[t].value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }));
+	}
+	return results;
+}
+
+// volatile keeps the compiler from summing in registers, as the real loop has a
+// function call between the updates
+std::vector<BenchmarkResult> run_sums(int threads, long iterations, const PlacementPlan &plan)
+{
+	std::vector<BenchmarkResult> results;
+	{
+		std::vector<Sums> slots(threads);
+		results.push_back(run("sums", "packed", threads, iterations, plan, [&](int t, long i)
+							  {
+			volatile Sums &sums = slots[t];
+			sums.id_sum = sums.id_sum - (int)(i & 7);
+			sums.age_sum = sums.age_sum + 0.5; }));
+	}
+	{
+		std::vector<CachePadded<Sums>> slots(threads);
+		results.push_back(run("sums", "padded", threads, iterations, plan, [&](int t, long i)
+							  {
+			volatile Sums &sums = slots[t].value;
+			sums.id_sum = sums.id_sum - (int)(i & 7);
+			sums.age_sum = sums.age_sum + 0.5; }));
+	}
+	return results;
+}
+
+void print_usage(const char *program)
+{
+	std::cerr << "Usage: " << program << " [--threads N] [--iterations N] [--csv <file>]" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	BenchmarkConfig config;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (i + 1 >= argc)
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+		if (arg == "--threads")
+			config.max_threads = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--iterations")
+			config.iterations = std::max(1L, std::stol(argv[++i]));
+		else if (arg == "--csv")
+			config.csv_file_name = argv[++i];
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	const CpuTopology topology = detect_topology();
+	print_topology(topology, std::cout);
+	{
+		PerfCounter probe(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+		if (!probe.available())
+			std::cout << "Performance counters unavailable (" << probe.get_error() << "), reporting times only." << std::endl;
+	}
+
+	std::vector<BenchmarkResult> results;
+	for (int threads = 1; threads <= config.max_threads; threads++)
+	{
+		// one thread per core first, so the slots really live in different caches
+		const PlacementPlan plan = plan_placement(topology, PlacementPolicy::Scatter, threads, false);
+		for (auto &r : run_counters(threads, config.iterations, plan))
+			results.push_back(r);
+		for (auto &r : run_sums(threads, config.iterations, plan))
+			results.push_back(r);
+	}
+
+	std::ofstream csv(config.csv_file_name);
+	csv << "workload,layout,threads,iterations,seconds,ns_per_update,l1d_misses,cache_misses" << std::endl;
+	std::cout << "| Workload | Layout | Threads | ns/update | L1D misses/update | Cache misses/update |" << std::endl;
+	std::cout << "|----------|--------|---------|-----------|-------------------|---------------------|" << std::endl;
+	for (auto &r : results)
+	{
+		const double updates = (double)r.threads * config.iterations;
+		const double ns_per_update = r.seconds * 1e9 * r.threads / updates;
+		csv << r.workload << "," << r.layout << "," << r.threads << "," << config.iterations << "," << r.seconds << "," << ns_per_update << ","
+			<< r.l1d_misses << "," << r.cache_misses << std::endl;
+		std::cout << "| " << std::setw(8) << std::left << r.workload << " | " << std::setw(6) << r.layout << std::right << " | " << std::setw(7) << r.threads
+				  << " | " << std::fixed << std::setprecision(2) << std::setw(9) << ns_per_update << " | " << std::setprecision(4) << std::setw(17);
+		if (r.l1d_misses < 0)
+			std::cout << "n/a";
+		else
+			std::cout << r.l1d_misses / updates;
+		std::cout << " | " << std::setw(19);
+		if (r.cache_misses < 0)
+			std::cout << "n/a";
+		else
+			std::cout << r.cache_misses / updates;
+		std::cout << " |" << std::endl;
+	}
+	std::cout << "Results written to '" << config.csv_file_name << "'." << std::endl;
+	return 0;
+}
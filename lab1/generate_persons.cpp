@@ -0,0 +1,354 @@
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "person.hpp"
+#include "person_formats.hpp"
+#include "person_table.hpp"
+
+// Generates large synthetic person datasets for benchmarking the pipelines.
+//
+// Records are generated in fixed size blocks, each with its own random engine
+// seeded from (seed, block index), so the output only depends on the options
+// and the seed, not on the number of threads. Blocks are generated in parallel
+// and written out in order, one round of blocks at a time, which keeps memory
+// use bounded no matter how many records are requested.
+
+constexpr std::uint64_t BLOCK_SIZE = 1 << 16;
+
+// A distribution given on the command line as "kind:a:b", for example
+// "uniform:0:100", "normal:50:10", "fixed:30" or "sequential:0".
+struct DistributionSpec
+{
+	std::string kind;
+	double a = 0;
+	double b = 0;
+};
+
+struct GeneratorConfig
+{
+	std::uint64_t count = 1000000;
+	std::string output_file_name = "persons.jsonl";
+	std::string format; // json, jsonl or bin; picked from the output extension if empty
+	DistributionSpec id_dist{"uniform", -1000000, 1000000};
+	DistributionSpec age_dist{"uniform", 0, 100};
+	DistributionSpec name_length_dist{"uniform", 3, 12};
+	double duplicate_ratio = 0;
+	double selectivity = -1; // fraction of records with id' < 0, negative leaves it to the id distribution
+	std::uint64_t seed = 42;
+	int threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+// What --selectivity achieved in one block or the whole file.
+struct SelectivityCount
+{
+	std::uint64_t passing = 0; // records with id' < 0, duplicates included
+	std::uint64_t missed = 0;  // records that stayed on the wrong side after every resample
+};
+
+bool parse_distribution(const std::string &text, DistributionSpec &spec)
+{
+	std::stringstream ss(text);
+	std::string part;
+	std::vector<std::string> parts;
+	while (std::getline(ss, part, ':'))
+		parts.push_back(part);
+	if (parts.empty())
+		return false;
+
+	spec.kind = parts[0];
+	try
+	{
+		if (spec.kind == "uniform" || spec.kind == "normal")
+		{
+			if (parts.size() != 3)
+				return false;
+			spec.a = std::stod(parts[1]);
+			spec.b = std::stod(parts[2]);
+			return spec.kind == "normal" ? spec.b > 0 : spec.a <= spec.b;
+		}
+		if (spec.kind == "fixed" || spec.kind == "sequential")
+		{
+			if (parts.size() != 2)
+				return false;
+			spec.a = std::stod(parts[1]);
+			return true;
+		}
+	}
+	catch (const std::exception &)
+	{
+	}
+	return false;
+}
+
+class RecordGenerator
+{
+public:
+	RecordGenerator(const GeneratorConfig &config, std::uint64_t block) : config(config)
+	{
+		std::seed_seq seq{(std::uint32_t)config.seed, (std::uint32_t)(config.seed >> 32), (std::uint32_t)block, (std::uint32_t)(block >> 32)};
+		gen.seed(seq);
+	}
+
+	double sample(const DistributionSpec &spec, std::uint64_t index)
+	{
+		if (spec.kind == "uniform")
+			return std::uniform_real_distribution<double>(spec.a, spec.b)(gen);
+		if (spec.kind == "normal")
+			return std::normal_distribution<double>(spec.a, spec.b)(gen);
+		if (spec.kind == "sequential")
+			return spec.a + index;
+		return spec.a; // fixed
+	}
+
+	int sample_id(std::uint64_t index)
+	{
+		const double value = std::clamp(std::round(sample(config.id_dist, index)), (double)INT32_MIN, (double)INT32_MAX);
+		return (int)value;
+	}
+
+	// Appends a new random person to the table.
+	void generate(std::uint64_t index, PersonTable &table)
+	{
+		Person person;
+		person.id = sample_id(index);
+		if (config.selectivity >= 0)
+		{
+			// resample the id until it lands on the requested side of the id' < 0 filter;
+			// sequential ids cannot be resampled, so they are nudged upwards instead
+			const bool should_pass = std::bernoulli_distribution(config.selectivity)(gen);
+			for (int attempt = 0; attempt < 1000 && (modified_id(person.id) < 0) != should_pass; attempt++)
+				person.id = config.id_dist.kind == "sequential" ? person.id + 1 : sample_id(index);
+			if ((modified_id(person.id) < 0) != should_pass)
+				missed++;
+		}
+
+		// ages are rounded to one decimal, like the bundled datasets
+		person.age = std::round(sample(config.age_dist, index) * 10) / 10;
+
+		const int name_length = std::max(1, (int)std::round(sample(config.name_length_dist, index)));
+		name.resize(name_length);
+		std::uniform_int_distribution<int> letter('a', 'z');
+		for (auto &c : name)
+			c = (char)letter(gen);
+		person.name = name;
+		table.push_back(person);
+	}
+
+	bool duplicate()
+	{
+		return config.duplicate_ratio > 0 && std::bernoulli_distribution(config.duplicate_ratio)(gen);
+	}
+
+	std::uint64_t pick(std::uint64_t count)
+	{
+		return std::uniform_int_distribution<std::uint64_t>(0, count - 1)(gen);
+	}
+
+	std::uint64_t missed = 0; // see SelectivityCount
+
+private:
+	const GeneratorConfig &config;
+	std::mt19937_64 gen;
+	std::string name; // reused between records
+};
+
+void append_json_record(std::string &out, const Person &p)
+{
+	char number[32];
+	out += "{\"age\":";
+	out.append(number, std::to_chars(number, number + sizeof(number), p.age).ptr);
+	out += ",\"id\":";
+	out.append(number, std::to_chars(number, number + sizeof(number), p.id).ptr);
+	out += ",\"name\":\"";
+	out += p.name; // generated names are plain lowercase letters, nothing to escape
+	out += "\"}";
+}
+
+// Serializes one block of records in the requested format.
+std::string generate_block(const GeneratorConfig &config, std::uint64_t block, SelectivityCount &count)
+{
+	const std::uint64_t first = block * BLOCK_SIZE;
+	const std::uint64_t last = std::min(config.count, first + BLOCK_SIZE);
+
+	RecordGenerator generator(config, block);
+	PersonTable persons;
+	persons.reserve(last - first);
+	for (std::uint64_t i = first; i < last; i++)
+	{
+		// duplicates copy an earlier record of the same block, so blocks stay independent
+		if (!persons.empty() && generator.duplicate())
+			persons.push_back(persons[generator.pick(persons.size())]);
+		else
+			generator.generate(i, persons);
+	}
+	if (config.selectivity >= 0)
+	{
+		count.missed = generator.missed;
+		count.passing = std::count_if(persons.begin(), persons.end(), [](const Person &p)
+									  { return modified_id(p.id) < 0; });
+	}
+
+	std::string out;
+	if (config.format == "bin")
+	{
+		std::ostringstream o;
+		for (Person p : persons)
+			write_person_record(o, p);
+		out = o.str();
+	}
+	else
+	{
+		out.reserve(persons.size() * 48);
+		for (std::uint64_t i = 0; i < persons.size(); i++)
+		{
+			if (config.format == "json")
+				out += (first + i == 0) ? "\n" : ",\n";
+			append_json_record(out, persons[i]);
+			if (config.format == "jsonl")
+				out += "\n";
+		}
+	}
+	return out;
+}
+
+bool generate(const GeneratorConfig &config)
+{
+	std::ofstream o(config.output_file_name, std::ios::binary);
+	if (!o.is_open())
+	{
+		std::cerr << "Failed to open '" << config.output_file_name << "' for writing." << std::endl;
+		return false;
+	}
+
+	if (config.format == "bin")
+		write_persons_binary_header(o, config.count);
+	else if (config.format == "json")
+		o << "[";
+
+	const std::uint64_t block_count = (config.count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	std::vector<std::string> round(config.threads);
+	std::vector<SelectivityCount> round_counts(config.threads);
+	SelectivityCount total;
+	for (std::uint64_t round_start = 0; round_start < block_count; round_start += config.threads)
+	{
+		const std::uint64_t round_blocks = std::min<std::uint64_t>(config.threads, block_count - round_start);
+		std::vector<std::thread> threads;
+		for (std::uint64_t t = 0; t < round_blocks; t++)
+			threads.emplace_back([&, t]
+								 { round[t] = generate_block(config, round_start + t, round_counts[t]); });
+		for (auto &thread : threads)
+			thread.join();
+		for (std::uint64_t t = 0; t < round_blocks; t++)
+		{
+			o.write(round[t].data(), round[t].size());
+			total.passing += round_counts[t].passing;
+			total.missed += round_counts[t].missed;
+		}
+	}
+
+	// ids the distribution can't put on the requested side within 1000 resamples skew the result
+	if (config.selectivity >= 0)
+	{
+		std::cout << "Selectivity: " << (double)total.passing / std::max<std::uint64_t>(config.count, 1) << " (requested "
+				  << config.selectivity << ")." << std::endl;
+		if (total.missed > 0)
+			std::cerr << total.missed << " records couldn't be moved to the requested side of the filter, widen --id-dist." << std::endl;
+	}
+
+	if (config.format == "json")
+		o << "\n]\n";
+	return (bool)o;
+}
+
+void print_usage(const char *program)
+{
+	std::cerr << "Usage: " << program << " [options]\n"
+			  << "  --count N              number of records (default 1000000)\n"
+			  << "  --output <file>        output file, format picked from .json/.jsonl/.bin (default persons.jsonl)\n"
+			  << "  --format json|jsonl|bin\n"
+			  << "  --id-dist D            uniform:min:max, normal:mean:stddev, sequential:start (default uniform:-1000000:1000000)\n"
+			  << "  --age-dist D           uniform:min:max, normal:mean:stddev, fixed:value (default uniform:0:100)\n"
+			  << "  --name-length D        uniform:min:max, normal:mean:stddev, fixed:length (default uniform:3:12)\n"
+			  << "  --duplicates R         fraction of records that repeat an earlier record (default 0)\n"
+			  << "  --selectivity F        fraction of records with id' < 0, i.e. passing the filter\n"
+			  << "  --seed N\n"
+			  << "  --threads N" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	GeneratorConfig config;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (i + 1 >= argc)
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+		std::string value = argv[++i];
+		bool ok = true;
+		if (arg == "--count")
+			config.count = std::stoull(value);
+		else if (arg == "--output")
+			config.output_file_name = value;
+		else if (arg == "--format")
+			config.format = value;
+		else if (arg == "--id-dist")
+			ok = parse_distribution(value, config.id_dist) && config.id_dist.kind != "fixed";
+		else if (arg == "--age-dist")
+			ok = parse_distribution(value, config.age_dist) && config.age_dist.kind != "sequential";
+		else if (arg == "--name-length")
+			ok = parse_distribution(value, config.name_length_dist) && config.name_length_dist.kind != "sequential";
+		else if (arg == "--duplicates")
+		{
+			config.duplicate_ratio = std::stod(value);
+			ok = config.duplicate_ratio >= 0 && config.duplicate_ratio <= 1;
+		}
+		else if (arg == "--selectivity")
+		{
+			config.selectivity = std::stod(value);
+			ok = config.selectivity >= 0 && config.selectivity <= 1;
+		}
+		else if (arg == "--seed")
+			config.seed = std::stoull(value);
+		else if (arg == "--threads")
+		{
+			config.threads = std::stoi(value);
+			ok = config.threads > 0;
+		}
+		else
+			ok = false;
+
+		if (!ok)
+		{
+			std::cerr << "Invalid value '" << value << "' for " << arg << "." << std::endl;
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (config.format.empty())
+		config.format = ends_with(config.output_file_name, ".bin") ? "bin" : ends_with(config.output_file_name, ".jsonl") ? "jsonl"
+																																 : "json";
+	if (config.format != "json" && config.format != "jsonl" && config.format != "bin")
+	{
+		std::cerr << "Unknown format '" << config.format << "'." << std::endl;
+		return 1;
+	}
+
+	std::cout << "Generating " << config.count << " persons into '" << config.output_file_name << "' (" << config.format
+			  << ") with " << config.threads << " threads." << std::endl;
+	if (!generate(config))
+		return 1;
+	std::cout << "Done." << std::endl;
+	return 0;
+}
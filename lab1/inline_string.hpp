@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string_view>
+#include <type_traits>
+
+#ifdef __CUDACC__
+#define INLINE_STRING_HD __host__ __device__
+#else
+#define INLINE_STRING_HD
+#endif
+
+// A string of at most N characters stored inside the object, like a char[N + 1]
+// that knows its length. It never allocates, is trivially copyable (so it can
+// be memcpy'd, spilled or sent to a GPU as is) and is always null-terminated.
+// Text beyond N characters is cut off.
+template <std::size_t N>
+class InlineString
+{
+public:
+	using size_type = std::conditional_t<(N < 256), std::uint8_t, std::uint32_t>;
+
+	INLINE_STRING_HD InlineString()
+	{
+		length = 0;
+		chars[0] = '\0';
+	}
+
+	InlineString(std::string_view text)
+	{
+		assign(text);
+	}
+
+	InlineString(const char *text) : InlineString(std::string_view(text))
+	{
+	}
+
+	InlineString &operator=(std::string_view text)
+	{
+		assign(text);
+		return *this;
+	}
+
+	InlineString &operator=(const char *text)
+	{
+		assign(text);
+		return *this;
+	}
+
+	void assign(std::string_view text)
+	{
+		length = text.size() < N ? text.size() : N;
+		std::memcpy(chars, text.data(), length);
+		chars[length] = '\0';
+	}
+
+	INLINE_STRING_HD void push_back(char c)
+	{
+		if (length == N)
+			return;
+		chars[length++] = c;
+		chars[length] = '\0';
+	}
+
+	INLINE_STRING_HD InlineString &operator+=(char c)
+	{
+		push_back(c);
+		return *this;
+	}
+
+	INLINE_STRING_HD void clear()
+	{
+		length = 0;
+		chars[0] = '\0';
+	}
+
+	INLINE_STRING_HD std::size_t size() const
+	{
+		return length;
+	}
+
+	INLINE_STRING_HD std::size_t capacity() const
+	{
+		return N;
+	}
+
+	INLINE_STRING_HD bool empty() const
+	{
+		return length == 0;
+	}
+
+	INLINE_STRING_HD const char *data() const
+	{
+		return chars;
+	}
+
+	INLINE_STRING_HD const char *c_str() const
+	{
+		return chars;
+	}
+
+	INLINE_STRING_HD char operator[](std::size_t i) const
+	{
+		return chars[i];
+	}
+
+	operator std::string_view() const
+	{
+		return std::string_view(chars, length);
+	}
+
+	friend bool operator==(const InlineString &a, const InlineString &b)
+	{
+		return std::string_view(a) == std::string_view(b);
+	}
+
+	friend bool operator!=(const InlineString &a, const InlineString &b)
+	{
+		return !(a == b);
+	}
+
+	// honours std::setw like std::string does
+	friend std::ostream &operator<<(std::ostream &o, const InlineString &s)
+	{
+		return o << std::string_view(s);
+	}
+
+private:
+	char chars[N + 1];
+	size_type length;
+};
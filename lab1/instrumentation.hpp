@@ -0,0 +1,339 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cache_line.hpp"
+#include "json.hpp"
+
+// Queue depths are counted in power-of-two buckets: 0, 1, 2-3, 4-7, ...;
+// bucket b > 0 holds the depths in [2^(b-1), 2^b).
+constexpr int QUEUE_DEPTH_BUCKETS = 32;
+
+inline int queue_depth_bucket(int depth)
+{
+	int bucket = 0;
+	while (depth > 0 && bucket < QUEUE_DEPTH_BUCKETS - 1)
+	{
+		depth >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+// Every thread keeps its own queue depth time series in this many samples.
+constexpr int QUEUE_DEPTH_SERIES_LENGTH = 1024;
+
+struct QueueDepthSample
+{
+	double time_ms; // since the start of the run
+	int depth;
+};
+
+// Per-thread counters. Every field is only written by the thread that owns the
+// entry, so no locking is needed while the pipeline runs; the summary is read
+// after all threads are joined. Entries sit next to each other in a deque, so
+// each one gets its own cache line to keep the owners from false sharing.
+struct alignas(cache_line_size) ThreadStats
+{
+	std::string role;
+	std::thread::id thread_id;
+	double add_wait_ms = 0;	   // blocked inside DataMonitor::addItem
+	double remove_wait_ms = 0; // blocked inside DataMonitor::removeItem
+	double sorted_wait_ms = 0; // blocked inside SortedResultMonitor::addItemSorted
+	double compute_ms = 0;	   // time spent inside modify_person_data
+	long items_processed = 0;
+	// queue depths seen by this thread's adds and removes, in fixed storage so
+	// recording one doesn't lock or allocate
+	long depth_histogram[QUEUE_DEPTH_BUCKETS] = {};
+	long depth_samples = 0;
+	long depth_total = 0;
+	int depth_max = 0;
+	// the depths over time, at most one sample per interval; once the series is
+	// full every second sample is dropped and the interval doubles, so it keeps
+	// covering the whole run
+	QueueDepthSample depth_series[QUEUE_DEPTH_SERIES_LENGTH];
+	int depth_series_length = 0;
+	double depth_series_interval_ms = 1;
+};
+
+class PipelineStats
+{
+public:
+	PipelineStats()
+	{
+		start = std::chrono::steady_clock::now();
+		id = next_id().fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Creates a stats entry for the calling thread. Threads that never register
+	// get an entry with the "unnamed" role the first time they are measured.
+	ThreadStats &register_thread(const std::string &role)
+	{
+		std::lock_guard<std::mutex> lock(stats_mtx);
+		threads.emplace_back();
+		ThreadStats &stats = threads.back();
+		stats.role = role;
+		stats.thread_id = std::this_thread::get_id();
+		current_thread_stats() = {id, &stats};
+		return stats;
+	}
+
+	// The calling thread's entry in this instance. The thread-local slot only
+	// caches the last instance the thread used; on a miss the entry is looked
+	// up here, so several instances and threads outliving one are fine.
+	ThreadStats &current()
+	{
+		CurrentStats &cached = current_thread_stats();
+		if (cached.owner == id)
+			return *cached.stats;
+		{
+			std::lock_guard<std::mutex> lock(stats_mtx);
+			for (auto it = threads.rbegin(); it != threads.rend(); ++it)
+				if (it->thread_id == std::this_thread::get_id())
+				{
+					cached = {id, &*it};
+					return *it;
+				}
+		}
+		return register_thread("unnamed");
+	}
+
+	double elapsed_ms() const
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// items processed by the threads with the given role, read once they are joined
+	long total_items(const std::string &role)
+	{
+		std::lock_guard<std::mutex> lock(stats_mtx);
+		long total = 0;
+		for (auto &t : threads)
+			if (t.role == role)
+				total += t.items_processed;
+		return total;
+	}
+
+	// Called under the monitor's lock on every add and remove, so it only
+	// touches the calling thread's entry.
+	void record_queue_depth(int depth)
+	{
+		ThreadStats &stats = current();
+		stats.depth_histogram[queue_depth_bucket(depth)]++;
+		stats.depth_samples++;
+		stats.depth_total += depth;
+		stats.depth_max = std::max(stats.depth_max, depth);
+
+		const double now_ms = elapsed_ms();
+		if (stats.depth_series_length > 0 && now_ms - stats.depth_series[stats.depth_series_length - 1].time_ms < stats.depth_series_interval_ms)
+			return;
+		if (stats.depth_series_length == QUEUE_DEPTH_SERIES_LENGTH)
+		{
+			for (int i = 0; i < QUEUE_DEPTH_SERIES_LENGTH / 2; i++)
+				stats.depth_series[i] = stats.depth_series[2 * i];
+			stats.depth_series_length = QUEUE_DEPTH_SERIES_LENGTH / 2;
+			stats.depth_series_interval_ms *= 2;
+		}
+		stats.depth_series[stats.depth_series_length++] = {now_ms, depth};
+	}
+
+	// Named run-wide counters (dropped items and the like), shown after the per-thread table.
+	void add_counter(const std::string &name, long value)
+	{
+		std::lock_guard<std::mutex> lock(stats_mtx);
+		for (auto &counter : counters)
+			if (counter.first == name)
+			{
+				counter.second += value;
+				return;
+			}
+		counters.emplace_back(name, value);
+	}
+
+	void print_summary(std::ostream &out)
+	{
+		std::lock_guard<std::mutex> lock(stats_mtx);
+		const double total_ms = elapsed_ms();
+
+		out << std::endl
+			<< "Pipeline statistics (" << std::fixed << std::setprecision(1) << total_ms << " ms total)" << std::endl;
+		out << "| Thread           | Role     | Items  | Add wait ms | Remove wait ms | Sorted wait ms | Compute ms |" << std::endl;
+		out << "|------------------|----------|--------|-------------|----------------|----------------|------------|" << std::endl;
+
+		double producer_wait = 0, worker_wait = 0, worker_compute = 0;
+		for (auto &t : threads)
+		{
+			std::ostringstream id;
+			id << t.thread_id;
+			out << "| " << std::setw(16) << id.str() << " | " << std::setw(8) << t.role << " | " << std::setw(6) << t.items_processed
+				<< " | " << std::setw(11) << t.add_wait_ms << " | " << std::setw(14) << t.remove_wait_ms
+				<< " | " << std::setw(14) << t.sorted_wait_ms << " | " << std::setw(10) << t.compute_ms << " |" << std::endl;
+
+			if (t.role == "producer")
+				producer_wait += t.add_wait_ms;
+			else
+			{
+				worker_wait += t.remove_wait_ms + t.sorted_wait_ms;
+				worker_compute += t.compute_ms;
+			}
+		}
+
+		const QueueDepth depth = merged_queue_depth();
+		out << "Queue depth: " << depth.samples << " samples, mean " << (depth.samples == 0 ? 0.0 : (double)depth.total / depth.samples)
+			<< ", max " << depth.max << std::endl;
+		if (depth.samples > 0)
+		{
+			out << "Queue depth histogram:";
+			for (int b = 0; b < QUEUE_DEPTH_BUCKETS; b++)
+				if (depth.histogram[b] > 0)
+					out << " " << bucket_name(b) << ": " << depth.histogram[b];
+			out << std::endl;
+		}
+		for (auto &counter : counters)
+			out << counter.first << ": " << counter.second << std::endl;
+
+		// a crude verdict: whoever spends the most time blocked is waiting on the other side
+		if (producer_wait > worker_wait && producer_wait > 0)
+			out << "Verdict: producer mostly blocked on a full queue, the run is kernel bound." << std::endl;
+		else if (worker_wait > worker_compute)
+			out << "Verdict: workers mostly blocked on an empty queue, the run is producer or queue bound." << std::endl;
+		else
+			out << "Verdict: workers mostly computing, the run is kernel bound." << std::endl;
+		out << std::defaultfloat;
+	}
+
+	void dump_json(const std::string &file_name)
+	{
+		std::lock_guard<std::mutex> lock(stats_mtx);
+		nlohmann::json dump;
+		dump["total_ms"] = elapsed_ms();
+		dump["threads"] = nlohmann::json::array();
+		for (auto &t : threads)
+		{
+			std::ostringstream id;
+			id << t.thread_id;
+			dump["threads"].push_back({{"thread", id.str()},
+									   {"role", t.role},
+									   {"items_processed", t.items_processed},
+									   {"add_wait_ms", t.add_wait_ms},
+									   {"remove_wait_ms", t.remove_wait_ms},
+									   {"sorted_wait_ms", t.sorted_wait_ms},
+									   {"compute_ms", t.compute_ms}});
+		}
+
+		dump["counters"] = nlohmann::json::object();
+		for (auto &counter : counters)
+			dump["counters"][counter.first] = counter.second;
+
+		const QueueDepth depth = merged_queue_depth();
+		dump["queue_depth"] = {{"samples", depth.samples}, {"max", depth.max}, {"histogram", nlohmann::json::object()}};
+		dump["queue_depth"]["mean"] = depth.samples == 0 ? 0.0 : (double)depth.total / depth.samples;
+		for (int b = 0; b < QUEUE_DEPTH_BUCKETS; b++)
+			if (depth.histogram[b] > 0)
+				dump["queue_depth"]["histogram"][bucket_name(b)] = depth.histogram[b];
+		// [time ms, depth] pairs of all threads, in time order
+		std::vector<QueueDepthSample> series;
+		for (auto &t : threads)
+			series.insert(series.end(), t.depth_series, t.depth_series + t.depth_series_length);
+		std::sort(series.begin(), series.end(), [](const QueueDepthSample &a, const QueueDepthSample &b)
+				  { return a.time_ms < b.time_ms; });
+		dump["queue_depth"]["series"] = nlohmann::json::array();
+		for (auto &sample : series)
+			dump["queue_depth"]["series"].push_back({sample.time_ms, sample.depth});
+
+		std::ofstream o(file_name);
+		if (!o.is_open())
+		{
+			std::cerr << "Failed to open '" << file_name << "' for the statistics dump." << std::endl;
+			return;
+		}
+		o << dump.dump(2) << std::endl;
+	}
+
+private:
+	struct QueueDepth
+	{
+		long histogram[QUEUE_DEPTH_BUCKETS] = {};
+		long samples = 0;
+		long total = 0;
+		int max = 0;
+	};
+
+	// the threads' histograms added up; called with stats_mtx held, after the threads are joined
+	QueueDepth merged_queue_depth() const
+	{
+		QueueDepth depth;
+		for (auto &t : threads)
+		{
+			for (int b = 0; b < QUEUE_DEPTH_BUCKETS; b++)
+				depth.histogram[b] += t.depth_histogram[b];
+			depth.samples += t.depth_samples;
+			depth.total += t.depth_total;
+			depth.max = std::max(depth.max, t.depth_max);
+		}
+		return depth;
+	}
+
+	static std::string bucket_name(int bucket)
+	{
+		if (bucket <= 1)
+			return std::to_string(bucket);
+		return std::to_string(1L << (bucket - 1)) + "-" + std::to_string((1L << bucket) - 1);
+	}
+
+	// owner is the id of the instance stats belongs to; ids are never reused,
+	// unlike addresses, so a stale slot can't match a new instance
+	struct CurrentStats
+	{
+		std::uint64_t owner = 0;
+		ThreadStats *stats = nullptr;
+	};
+
+	static CurrentStats &current_thread_stats()
+	{
+		thread_local CurrentStats current;
+		return current;
+	}
+
+	static std::atomic<std::uint64_t> &next_id()
+	{
+		static std::atomic<std::uint64_t> id{1};
+		return id;
+	}
+
+	std::uint64_t id;
+	std::chrono::steady_clock::time_point start;
+	std::mutex stats_mtx;
+	std::deque<ThreadStats> threads; // deque keeps references stable while threads register
+	std::vector<std::pair<std::string, long>> counters;
+};
+
+// Adds the lifetime of the scope to the given counter, in milliseconds.
+class ScopedTimer
+{
+public:
+	explicit ScopedTimer(double &target) : target(target)
+	{
+		start = std::chrono::steady_clock::now();
+	}
+	~ScopedTimer()
+	{
+		target += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+private:
+	double &target;
+	std::chrono::steady_clock::time_point start;
+};
@@ -2,78 +2,173 @@
 #include <vector>
 #include <fstream>
 #include <random>
+#include <memory_resource>
 #include <omp.h>
 #include <thread>
+#include <optional>
+#include "alloc_counter.hpp"
+#include "arena.hpp"
+#include "batch.hpp"
+#include "cancellation.hpp"
+#include "checkpoint.hpp"
+#include "cache_line.hpp"
+#include "engine.hpp"
 #include "json.hpp"
+#include "person.hpp"
+#include "person_formats.hpp"
+#include "person_table.hpp"
+#include "radix_sort.hpp"
+#include "simd_kernel.hpp"
+#include "top_k.hpp"
+#include "topology.hpp"
+#include "trace.hpp"
 using json = nlohmann::json;
 
-struct Person
+// Per-thread partial sums, each on its own cache line.
+struct PartialSums
 {
-	int id;
-	double age;
-	std::string name;
+	int id_sum = 0;
+	double age_sum = 0;
+	int processed = 0; // records whose computation finished
+	double busy_ms = 0; // spent in modify_person_data
 };
 
-struct PersonWithChangedData
+// Results in age order (Younger). Two runs merge in linear time, so the
+// threads' results are an OpenMP reduction rather than a shared monitor: every
+// thread fills and sorts a private run, and the runtime merges the private runs
+// into the original one when the parallel region ends.
+struct SortedRun
 {
-	Person originalData;
-	int id;
-	double age;
-	std::string name;
+	std::vector<PersonWithChangedData> items;
+
+	// Insertion keeps the run sorted as it grows, the other methods sort it in finish()
+	void add(const PersonWithChangedData &item, SortMethod method)
+	{
+		if (method == SortMethod::Insertion)
+			items.insert(std::upper_bound(items.begin(), items.end(), item, Younger()), item);
+		else
+			items.push_back(item);
+	}
+
+	void finish(SortMethod method)
+	{
+		sort_results(items, method, 1);
+	}
+
+	void merge(const SortedRun &other)
+	{
+		std::vector<PersonWithChangedData> merged;
+		merged.reserve(items.size() + other.items.size());
+		std::merge(items.begin(), items.end(), other.items.begin(), other.items.end(), std::back_inserter(merged), Younger());
+		items.swap(merged);
+	}
 };
 
-class SortedResultMonitor
+#pragma omp declare reduction(merge_runs : SortedRun : omp_out.merge(omp_in))
+#pragma omp declare reduction(merge_top : TopK<PersonWithChangedData, Younger> : omp_out.merge(omp_in)) \
+	initializer(omp_priv = TopK<PersonWithChangedData, Younger>(omp_orig.capacity()))
+
+// Parses a --schedule value, "static", "dynamic", "guided" or "auto",
+// optionally followed by ",<chunk size>".
+bool parse_schedule(const std::string &value, omp_sched_t &kind, int &chunk)
+{
+	const size_t comma = value.find(',');
+	const std::string name = value.substr(0, comma);
+	if (name == "static")
+		kind = omp_sched_static;
+	else if (name == "dynamic")
+		kind = omp_sched_dynamic;
+	else if (name == "guided")
+		kind = omp_sched_guided;
+	else if (name == "auto")
+		kind = omp_sched_auto;
+	else
+		return false;
+	chunk = 0; // the kind's default
+	if (comma != std::string::npos)
+	{
+		try
+		{
+			chunk = std::stoi(value.substr(comma + 1));
+		}
+		catch (const std::exception &)
+		{
+			return false;
+		}
+		if (chunk < 1)
+			return false;
+	}
+	return true;
+}
+
+std::string schedule_name(omp_sched_t kind, int chunk)
+{
+	std::string name;
+	switch ((int)kind & ~(int)omp_sched_monotonic)
+	{
+	case omp_sched_static:
+		name = "static";
+		break;
+	case omp_sched_dynamic:
+		name = "dynamic";
+		break;
+	case omp_sched_guided:
+		name = "guided";
+		break;
+	default:
+		name = "auto";
+		break;
+	}
+	return chunk > 0 ? name + "," + std::to_string(chunk) : name;
+}
+
+// Prints how much of the parallel region every thread spent computing. A
+// thread that got cheap records, or few of them, is idle for the rest of the
+// region, which shows as a low busy share and a max/mean ratio above 1.
+void print_load_balance(const std::vector<CachePadded<PartialSums>> &partial_sums, double region_ms, std::ostream &out)
+{
+	double total_ms = 0, max_ms = 0;
+	for (auto &slot : partial_sums)
+	{
+		total_ms += slot.value.busy_ms;
+		max_ms = std::max(max_ms, slot.value.busy_ms);
+	}
+	const double mean_ms = total_ms / partial_sums.size();
+	out << "Load balance over " << std::fixed << std::setprecision(1) << region_ms << " ms:" << std::endl;
+	for (size_t t = 0; t < partial_sums.size(); t++)
+	{
+		const PartialSums &sums = partial_sums[t].value;
+		out << "  Thread #" << t << ": " << sums.processed << " records, " << sums.busy_ms << " ms busy ("
+			<< (region_ms > 0 ? 100.0 * sums.busy_ms / region_ms : 0.0) << "%)" << std::endl;
+	}
+	out << "Busy time max/mean: " << std::setprecision(2) << (mean_ms > 0 ? max_ms / mean_ms : 1.0) << std::defaultfloat << std::endl;
+}
+
+// A batch file's results, filled by tasks of any thread and guarded by critical
+// sections (monitors.hpp has the std::thread SortedResultMonitor). It doesn't
+// print every insertion, which would interleave across the batch's files.
+class OmpSortedResultMonitor
 {
 public:
-	SortedResultMonitor(int size)
+	// sort_method other than Insertion appends results as they come and sorts them once in getItems
+	OmpSortedResultMonitor(int size, std::pmr::memory_resource *resource = std::pmr::get_default_resource(),
+						SortMethod sort_method = SortMethod::Insertion)
+		: persons(resource)
 	{
 		if (size < 1)
 		{
-			throw std::runtime_error("Incorrect initial given size to a SortedResultMonitor. Initial size has to be at least 1.");
+			throw std::runtime_error("Incorrect initial given size to a OmpSortedResultMonitor. Initial size has to be at least 1.");
 		}
 
-		persons = new PersonWithChangedData[size];
+		persons.resize(size);
 		this->size = size;
 		this->size_used = 0;
-	}
-	~SortedResultMonitor()
-	{
-		delete[] persons;
+		this->sort_method = sort_method;
 	}
 	void addItemSorted(PersonWithChangedData item)
 	{
 #pragma omp critical
-		{
-			std::cout << "Thread #" << omp_get_thread_num() << ": Adding item with age " << item.age << " to the sorted list.\n";
-			// find the position to place the item, and if needed push other elements forwards
-			if (size_used == 0)
-			{
-				persons[0] = item;
-			}
-			else
-			{
-				int index_to_insert = -1;
-				for (int i = 0; i < size_used; i++)
-					if (item.age < persons[i].age)
-					{
-						index_to_insert = i;
-						break;
-					}
-
-				if (index_to_insert == -1)
-					persons[size_used] = item;
-				else
-				{
-					// shift the existing persons to the right
-					for (int i = size_used; i > index_to_insert; i--)
-						persons[i] = persons[i - 1];
-
-					// insert the new person
-					persons[index_to_insert] = item;
-				}
-			}
-			size_used++;
-		}
+		insert(item);
 	}
 	std::vector<PersonWithChangedData> getItems()
 	{
@@ -82,157 +177,428 @@ public:
 		{
 			items.push_back(persons[i]);
 		}
+		sort_results(items, sort_method, omp_get_max_threads());
 		return items;
 	}
 
 private:
-	PersonWithChangedData *persons;
+	void insert(const PersonWithChangedData &item)
+	{
+		if (sort_method != SortMethod::Insertion)
+		{
+			persons[size_used++] = item; // sorted later, in getItems
+			return;
+		}
+		// find the position to place the item, and if needed push other elements forwards
+		if (size_used == 0)
+		{
+			persons[0] = item;
+		}
+		else
+		{
+			int index_to_insert = -1;
+			for (int i = 0; i < size_used; i++)
+				if (item.age < persons[i].age)
+				{
+					index_to_insert = i;
+					break;
+				}
+
+			if (index_to_insert == -1)
+				persons[size_used] = item;
+			else
+			{
+				// shift the existing persons to the right
+				for (int i = size_used; i > index_to_insert; i--)
+					persons[i] = persons[i - 1];
+
+				// insert the new person
+				persons[index_to_insert] = item;
+			}
+		}
+		size_used++;
+	}
+
+	std::pmr::vector<PersonWithChangedData> persons;
 	int size;
 	int size_used;
+	SortMethod sort_method;
 };
 
-void save_persons_table(const std::vector<Person> &data, const std::string &file_name, const std::string &title, const bool &append)
+// Batch mode (--batch): many inputs through one OpenMP team. One thread loads
+// the files one after the other and creates a task per record, so the other
+// threads start on the next file while the last tasks of the previous one are
+// still running. Every file has its own results and sums, and the task that
+// finishes a file's last record writes its results file, concurrently with
+// the rest of the batch.
+struct BatchFile
 {
-	std::cout << "saving " << data.size() << " persons.\n";
+	BatchInput paths;
+	PersonTable data;
+	std::unique_ptr<OmpSortedResultMonitor> sorted_results;
+	std::unique_ptr<TopK<PersonWithChangedData, Younger>> top_results; // instead of sorted_results with --top-k
+	PartialSums sums;
+	std::atomic<long> remaining{0};
+};
 
-	std::ofstream o;
-	if (append)
-		o.open(file_name, std::ios_base::app);
+void write_batch_file(BatchFile &file, int top_k)
+{
+	TRACE_SPAN("save");
+	save_persons_table(file.data, file.paths.output, "Original people's data", false);
+	if (top_k > 0)
+		save_modified_persons_table(file.top_results->sorted(), file.paths.output, "Modified people's data, filtered by ID, " + std::to_string(top_k) + " youngest",
+									true, file.sums.id_sum, file.sums.age_sum);
 	else
-		o.open(file_name);
+		save_modified_persons_table(file.sorted_results->getItems(), file.paths.output, "Modified people's data, filtered by ID, sorted by age", true,
+									file.sums.id_sum, file.sums.age_sum);
+	std::cout << "Batch: wrote the results of '" << file.paths.input << "' to '" << file.paths.output << "'." << std::endl;
+	// nothing refers to the file's records any more
+	file.sorted_results.reset();
+	file.top_results.reset();
+	file.data = PersonTable();
+}
 
-	if (data.size() > 0)
+void process_batch_record(BatchFile &file, size_t row, int top_k, const CancellationToken &cancel)
+{
+	std::optional<PersonWithChangedData> p_changed;
 	{
-		o << "_________________________________________________________" << std::endl;
-		o << "| " << std::setw(52) << title << " |" << std::endl;
-		o << "|-------------------------------------------------------|" << std::endl;
-		o << "| ID          | Name                           | Age    |" << std::endl;
-		o << "|-------------------------------------------------------|" << std::endl;
-		for (auto &p : data)
-		{
-			o << "| " << std::setw(11) << p.id << " | " << std::setw(30) << p.name << " | " << std::setw(6) << p.age << " |" << std::endl;
-		}
-		o << "|-------------------------------------------------------|" << std::endl;
-		o << std::endl;
+		TRACE_SPAN("compute");
+		p_changed = modify_person_data(file.data[row], cancel);
 	}
-	else
+	if (p_changed->id < 0)
 	{
-		o << "No people's data. Either there was no data to begin with, or all of it was filtered." << std::endl;
+#pragma omp critical(batch_results)
+		{
+			file.sums.id_sum += p_changed->id;
+			file.sums.age_sum += p_changed->age;
+			if (top_k > 0)
+				file.top_results->push(*p_changed);
+		}
+		if (top_k == 0)
+			file.sorted_results->addItemSorted(*p_changed);
 	}
-	o.close();
+	if (--file.remaining == 0)
+		write_batch_file(file, top_k);
 }
 
-void save_modified_persons_table(const std::vector<PersonWithChangedData> &data, const std::string &file_name, const std::string &title, const bool &append, const int &id_sum, const double &age_sum)
+// Returns the exit code: 1 if any input couldn't be processed.
+int run_batch(const std::vector<BatchInput> &inputs, int top_k, SortMethod sort_method)
 {
-	std::cout << "saving " << data.size() << " modified persons.\n";
-
-	std::ofstream o;
-	if (append)
-		o.open(file_name, std::ios_base::app);
-	else
-		o.open(file_name);
+	std::vector<std::unique_ptr<BatchFile>> files;
+	for (auto &input : inputs)
+	{
+		files.push_back(std::make_unique<BatchFile>());
+		files.back()->paths = input;
+	}
 
-	if (data.size() > 0)
+	const CancellationToken never_cancelled;
+	int failed = 0;
+	std::cout << "Batch: " << files.size() << " input(s) on " << omp_get_max_threads() << " threads." << std::endl;
+#pragma omp parallel
+#pragma omp single
+	for (auto &file : files)
 	{
-		o << "_________________________________________________________" << std::endl;
-		o << "| " << std::setw(52) << title << " |" << std::endl;
-		o << "|-------------------------------------------------------|" << std::endl;
-		o << "| ID          | Name                           | Age    |" << std::endl;
-		o << "|-------------------------------------------------------|" << std::endl;
-		for (auto &p : data)
+		// an exception must not leave the parallel region, that would terminate the program
+		try
 		{
-			o << "| " << std::setw(11) << p.id << " | " << std::setw(30) << p.name << " | " << std::setw(6) << p.age << " |" << std::endl;
+			TRACE_SPAN("load");
+			file->data = load_persons_file(file->paths.input);
+		}
+		catch (const std::exception &e)
+		{
+			std::cerr << "Batch: skipping '" << file->paths.input << "': " << e.what() << std::endl;
+			failed++;
+			continue;
+		}
+		if (file->data.empty())
+		{
+			std::cerr << "Batch: skipping '" << file->paths.input << "': there is no data in it." << std::endl;
+			failed++;
+			continue;
+		}
+		// once the last task is created, it may finish the file and reset its data
+		const size_t rows = file->data.size();
+		if (top_k > 0)
+			file->top_results = std::make_unique<TopK<PersonWithChangedData, Younger>>(top_k, Younger());
+		else
+			file->sorted_results = std::make_unique<OmpSortedResultMonitor>(rows, std::pmr::get_default_resource(), sort_method);
+		file->remaining = rows;
+		BatchFile *batch_file = file.get();
+		for (size_t row = 0; row < rows; row++)
+		{
+#pragma omp task firstprivate(batch_file, row) shared(never_cancelled)
+			process_batch_record(*batch_file, row, top_k, never_cancelled);
 		}
-		o << "|-------------------------------------------------------|" << std::endl;
-		o << "ID sum: " << id_sum << std::endl;
-		o << "Age sum: " << age_sum << std::endl;
 	}
-	else
+	// the end of the parallel region waits for every task
+	return failed > 0 ? 1 : 0;
+}
+
+// Task-graph mode (--pipeline tasks): loading, computing and writing the
+// results overlap. The thread in the single region reads the input in chunks
+// and creates two tasks for every chunk as soon as it is read:
+//
+//   compute k  depend(in: chunk k's data) depend(out: chunk k's results)
+//   merge k    depend(in: chunk k's results) depend(mutexinoutset: totals)
+//
+// The merges run one at a time, in any order, which is what the critical
+// section used to be for. Once the input is read the loading thread writes the
+// original table in a task of its own while the chunks are still being
+// computed, and the task writing the results waits for every merge and,
+// through the results file, for it.
+struct TaskChunk
+{
+	TaskChunk(PersonTable data, int top_k) : data(std::move(data)), top(top_k, Younger())
 	{
-		o << "No modified people's data. Either there was no data to begin with, or all of it was filtered." << std::endl;
 	}
-	o.close();
-}
 
-std::vector<Person> load_json_file(const std::string &file_name)
+	PersonTable data;
+	SortedRun run;
+	TopK<PersonWithChangedData, Younger> top; // instead of run with --top-k
+	PartialSums sums;
+};
+
+// What the chunk tasks share. They get it by pointer: the chunk callback that
+// creates them, and whatever it captured, is gone by the time they run.
+struct TaskPipeline
 {
-	std::ifstream f(file_name);
-	if (!f.is_open())
+	TaskPipeline(int top_k, SortMethod sort_method, const CancellationToken &cancel) : totals(PersonTable(), top_k), cancel(cancel)
 	{
-		std::cerr << "Failed to open given '" << file_name << "' file." << std::endl;
-		return std::vector<Person>();
+		this->top_k = top_k;
+		this->sort_method = sort_method;
+		start = std::chrono::steady_clock::now();
 	}
-	json data = json::parse(f);
-	std::vector<Person> data_vector;
-	for (auto &element : data)
+
+	double elapsed_ms() const
 	{
-		Person person;
-		element.at("id").get_to(person.id);
-		element.at("age").get_to(person.age);
-		element.at("name").get_to(person.name);
-		data_vector.push_back(person);
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 	}
-	f.close();
 
-	return data_vector;
-}
+	TaskChunk totals; // the merged results of every chunk
+	const CancellationToken &cancel;
+	int top_k;
+	SortMethod sort_method;
+	std::chrono::steady_clock::time_point start;
+	double merged_ms = 0; // when the last merge finished
+};
 
-PersonWithChangedData modify_person_data(const Person &person)
+void compute_chunk(TaskChunk &chunk, const TaskPipeline &pipeline)
 {
-	PersonWithChangedData p;
-	p.originalData = person;
-
-	// Generate a new id with very complex calculations
-	p.id = 0;
-	for (int i = 0; i < 1000000; i++)
+	TRACE_SPAN("compute");
+	for (std::size_t i = 0; i < chunk.data.size() && !pipeline.cancel.is_cancelled(); i++)
 	{
-		p.id += person.id * i;
-		for (int j = 0; j < 100; j++)
+		std::optional<PersonWithChangedData> p_changed = modify_person_data(chunk.data[i], pipeline.cancel);
+		if (!p_changed)
+			break;
+		chunk.sums.processed++;
+		if (p_changed->id < 0)
 		{
-			p.id += i * j;
+			chunk.sums.id_sum += p_changed->id;
+			chunk.sums.age_sum += p_changed->age;
+			if (pipeline.top_k > 0)
+				chunk.top.push(*p_changed);
+			else
+				chunk.run.add(*p_changed, pipeline.sort_method);
 		}
 	}
-	p.id /= 100000000;
+	chunk.run.finish(pipeline.sort_method);
+}
+
+// only ever runs in one task at a time
+void merge_chunk(const TaskChunk &chunk, TaskPipeline &pipeline)
+{
+	TRACE_SPAN("merge");
+	TaskChunk &totals = pipeline.totals;
+	totals.run.merge(chunk.run);
+	totals.top.merge(chunk.top);
+	totals.sums.id_sum += chunk.sums.id_sum;
+	totals.sums.age_sum += chunk.sums.age_sum;
+	totals.sums.processed += chunk.sums.processed;
+	pipeline.merged_ms = pipeline.elapsed_ms();
+}
+
+// Returns the exit code: 1 if there was no data.
+int run_task_pipeline(const std::string &file_name, const std::string &results_file_name, std::size_t chunk_rows, int top_k, SortMethod sort_method,
+					  const CancellationToken &cancel)
+{
+	TaskPipeline pipeline(top_k, sort_method, cancel);
+	std::vector<std::unique_ptr<TaskChunk>> chunks;
+	std::size_t rows = 0;
+	double loaded_ms = 0, original_ms = 0, results_ms = 0;
 
-	// Generate a new age with very complex calculations
-	p.age = person.age;
-	for (int i = 0; i < 1000000; i++)
+#pragma omp parallel
+#pragma omp single
 	{
-		if (p.age < 0)
-			p.age += -p.age * 3.1425;
-		else
-			p.age += p.age * 3.1425;
-		for (int j = 0; j < 100; j++)
 		{
-			p.age += i + j;
+			TRACE_SPAN("load");
+			read_persons_in_chunks(file_name, chunk_rows, [&](PersonTable &&data)
+								   {
+				rows += data.size();
+				chunks.push_back(std::make_unique<TaskChunk>(std::move(data), top_k));
+				TaskChunk *chunk = chunks.back().get();
+				TaskPipeline *shared = &pipeline;
+#pragma omp task firstprivate(chunk, shared) depend(in : chunk->data) depend(out : chunk->run)
+				compute_chunk(*chunk, *shared);
+#pragma omp task firstprivate(chunk, shared) depend(in : chunk->run) depend(mutexinoutset : shared->totals)
+				merge_chunk(*chunk, *shared); });
 		}
-		if (p.age < 0 || p.age > 10000)
+		loaded_ms = pipeline.elapsed_ms();
+		std::cout << "Loaded " << rows << " persons from '" << file_name << "' in " << chunks.size() << " chunks." << std::endl;
+
+		if (rows > 0)
 		{
-			p.age = person.age;
+			// undeferred: the loading thread writes it at once instead of queueing it behind the compute tasks
+#pragma omp task if (0) depend(inout : results_file_name)
+			{
+				TRACE_SPAN("save original");
+				PersonTable data;
+				for (auto &chunk : chunks)
+					for (Person p : chunk->data)
+						data.push_back(p);
+				save_persons_table(data, results_file_name, "Original people's data", false);
+				original_ms = pipeline.elapsed_ms();
+			}
+#pragma omp task depend(in : pipeline.totals) depend(inout : results_file_name)
+			{
+				TRACE_SPAN("save results");
+				const TaskChunk &totals = pipeline.totals;
+				if (top_k > 0)
+					save_modified_persons_table(totals.top.sorted(), results_file_name, "Modified people's data, filtered by ID, " + std::to_string(top_k) + " youngest",
+												true, totals.sums.id_sum, totals.sums.age_sum);
+				else
+					save_modified_persons_table(totals.run.items, results_file_name, "Modified people's data, filtered by ID, sorted by age", true,
+												totals.sums.id_sum, totals.sums.age_sum);
+				if (cancel.is_cancelled())
+					append_partial_marker(results_file_name, rows - totals.sums.processed, rows);
+				results_ms = pipeline.elapsed_ms();
+			}
 		}
 	}
 
-	// Generate a new name with very complex calculations
-	p.name = "";
-	for (int i = 0; i < 10; i++)
+	if (rows == 0)
 	{
-		char randomChar = (char)((int)pow(person.id + i, 4) % 25 + 'A'); // Generate 'A' to 'Z'
-		p.name += randomChar;
-		for (int j = 0; j < 2; j++)
-		{
-			randomChar = (char)((int)pow(person.age + i * j, 5) % 25 + 'A'); // Generate 'A' to 'Z'
-			p.name += randomChar;
-		}
+		std::cerr << "There is no data in '" + file_name + "'. Closing the program." << std::endl;
+		return 1;
 	}
-
-	return p;
+	std::cout << std::fixed << std::setprecision(1) << "Task pipeline: input read at " << loaded_ms << " ms, original table written at " << original_ms
+			  << " ms, last chunk merged at " << pipeline.merged_ms << " ms, results written at " << results_ms << " ms." << std::defaultfloat << std::endl;
+	return 0;
 }
 
-int main()
+int main(int argc, char *argv[])
 {
 	std::string file_name = "filters_some.json";
 	std::string results_file_name = "results_openmp.txt";
-	std::vector<Person> data = load_json_file(file_name);
+	PlacementPolicy placement = PlacementPolicy::None;
+	bool avoid_smt = false;
+	int top_k = 0; // 0 - keep every result
+	SortMethod sort_method = SortMethod::Insertion;
+	bool sort_given = false; // --sort was passed, not just the default
+	double deadline_s = 0; // 0 - no deadline
+	std::string checkpoint_file_name; // log of finished records, none if empty
+	bool resume = false;			  // skip the records logged in checkpoint_file_name
+	std::vector<std::string> batch_patterns; // --batch inputs, processed instead of --input
+	std::string output_dir;					 // where batch results go, next to the inputs if empty
+	std::optional<Backend> engine_backend;	 // run the shared engine on this backend instead
+	bool compare = false;					 // run the shared engine on every backend and compare them
+	std::optional<std::pair<omp_sched_t, int>> schedule; // --schedule; OMP_SCHEDULE, or static, if not given
+	// scalar - modify_person_data per record, simd - simd_kernel.hpp on blocks of SIMD_LANES records
+	std::string kernel = "scalar";
+	// loop - load, then one parallel loop, then save; tasks - the task graph of run_task_pipeline
+	std::string pipeline = "loop";
+	int chunk_rows = 8; // records per chunk with --pipeline tasks
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--input" && i + 1 < argc)
+			file_name = argv[++i];
+		else if (arg == "--affinity" && i + 1 < argc && parse_placement_policy(argv[i + 1], placement))
+			i++;
+		else if (arg == "--no-smt")
+			avoid_smt = true;
+		else if (arg == "--top-k" && i + 1 < argc)
+			top_k = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--sort" && i + 1 < argc && parse_sort_method(argv[i + 1], sort_method))
+		{
+			i++;
+			sort_given = true;
+		}
+		else if (arg == "--deadline" && i + 1 < argc)
+			deadline_s = std::stod(argv[++i]);
+		else if (arg == "--checkpoint" && i + 1 < argc)
+			checkpoint_file_name = argv[++i];
+		else if (arg == "--resume")
+			resume = true;
+		else if (arg == "--batch" && i + 1 < argc)
+			batch_patterns.push_back(argv[++i]);
+		else if (arg == "--output-dir" && i + 1 < argc)
+			output_dir = argv[++i];
+		else if (arg == "--backend" && i + 1 < argc && parse_backend(argv[i + 1], engine_backend.emplace()))
+			i++;
+		else if (arg == "--compare")
+			compare = true;
+		else if (arg == "--schedule" && i + 1 < argc && parse_schedule(argv[i + 1], schedule.emplace().first, schedule->second))
+			i++;
+		else if (arg == "--kernel" && i + 1 < argc && (std::string(argv[i + 1]) == "scalar" || std::string(argv[i + 1]) == "simd"))
+			kernel = argv[++i];
+		else if (arg == "--pipeline" && i + 1 < argc && (std::string(argv[i + 1]) == "loop" || std::string(argv[i + 1]) == "tasks"))
+			pipeline = argv[++i];
+		else if (arg == "--chunk" && i + 1 < argc)
+			chunk_rows = std::max(1, std::stoi(argv[++i]));
+		else
+		{
+			std::cerr << "Unknown argument '" << arg << "'. Usage: " << argv[0] << " [--input <file>] [--affinity none|compact|scatter] [--no-smt] [--top-k K] [--sort insert|radix|std]"
+					  << " [--schedule static|dynamic|guided|auto[,<chunk>]] [--kernel scalar|simd] [--pipeline loop|tasks] [--chunk N] [--deadline <seconds>] [--checkpoint <file> [--resume]] [--batch <file|pattern|@list>]... [--output-dir <dir>]"
+					  << " [--backend serial|threads|omp-static|omp-dynamic|omp-guided|work-stealing] [--compare]" << std::endl;
+			return 1;
+		}
+	}
+
+	trace::enable_from_env();
+	TRACE_THREAD_NAME("main");
+
+	if (!batch_patterns.empty())
+	{
+		if (deadline_s > 0 || !checkpoint_file_name.empty())
+		{
+			std::cerr << "--batch can't be combined with --deadline or --checkpoint." << std::endl;
+			return 1;
+		}
+		std::vector<BatchInput> inputs;
+		try
+		{
+			inputs = plan_batch(expand_batch_patterns(batch_patterns), output_dir, results_file_name);
+			if (!output_dir.empty())
+				std::filesystem::create_directories(output_dir);
+		}
+		catch (const std::exception &e)
+		{
+			std::cerr << e.what() << " Closing the program." << std::endl;
+			return 1;
+		}
+		return run_batch(inputs, top_k, sort_method);
+	}
+
+	// the deadline counts from the start of the run; when it passes, the threads stop and what they have is saved
+	CancellationToken cancel;
+	std::optional<DeadlineWatchdog> watchdog;
+	if (deadline_s > 0)
+		watchdog.emplace(cancel, deadline_s);
+	if (pipeline == "tasks")
+	{
+		if (!checkpoint_file_name.empty() || kernel != "scalar" || engine_backend || compare)
+		{
+			std::cerr << "--pipeline tasks can't be combined with --checkpoint, --kernel simd, --backend or --compare." << std::endl;
+			return 1;
+		}
+		return run_task_pipeline(file_name, results_file_name, chunk_rows, top_k, sort_method, cancel);
+	}
+	PersonTable data;
+	{
+		TRACE_SPAN("load");
+		data = load_persons_file(file_name);
+	}
 	std::cout << "Loaded " << data.size() << " persons from '" << file_name << "'." << std::endl;
 	bool data_exists = data.size() > 0;
 	if (!data_exists)
@@ -241,68 +607,225 @@ int main()
 		return 1;
 	}
 
-	SortedResultMonitor sorted_monitor(data.size());
-	int full_id_sum = 0;
-	double full_age_sum = 0;
-#pragma omp parallel
+	// --backend/--compare: the shared engine instead of this program's own pipeline
+	if (engine_backend || compare)
 	{
-		int thread_id = omp_get_thread_num();
-		// crude way of splitting the data between threads
-		int num_threads = omp_get_num_threads();
-		int num_items_per_thread = data.size() / num_threads;
-		int num_items_leftover = data.size() % num_threads;
-
-// #pragma omp single
-// 		std::cout << "There are " << num_threads << " threads, each processing " << num_items_per_thread << " items, with " << num_items_leftover << " items leftover.\n";
-
-		int start_index = thread_id * num_items_per_thread;
-		int end_index = start_index + num_items_per_thread;
-
-// #pragma omp critical
-// 		{
-// 			std::cout << "Thread1 #" << thread_id << ": processing " << (end_index - start_index) << " items from " << start_index << " to " << end_index << ".\n";
-// 		}
-
-		if (thread_id < num_items_leftover)
+		// the engine collects every result and sorts them once with std::sort, so it has no use for these
+		if (deadline_s > 0 || !checkpoint_file_name.empty() || top_k > 0 || sort_given)
 		{
-			start_index += thread_id;
-			end_index += thread_id + 1;
+			std::cerr << "--backend and --compare can't be combined with --deadline, --checkpoint, --top-k or --sort." << std::endl;
+			return 1;
 		}
-		else
+		const int threads = omp_get_max_threads();
+		try
 		{
-			start_index += num_items_leftover;
-			end_index += num_items_leftover;
+			if (compare)
+				return compare_backends(data, threads, std::cout) ? 0 : 1;
+			EngineResult run = run_engine(data, *engine_backend, threads);
+			std::cout << "Engine: " << backend_name(*engine_backend) << " backend, " << run.threads << " threads, " << run.elapsed_ms << " ms." << std::endl;
+			save_persons_table(data, results_file_name, "Original people's data", false);
+			save_modified_persons_table(run.results, results_file_name, "Modified people's data, filtered by ID, sorted by age", true, &run.sums);
 		}
+		catch (const std::exception &e)
+		{
+			std::cerr << e.what() << " Closing the program." << std::endl;
+			return 1;
+		}
+		return 0;
+	}
 
-		// the last element possibly doesn't have a full num_items_per_thread elements
-		if (thread_id == num_threads - 1)
-			end_index = data.size();
+	// with --resume the records an earlier run logged are skipped and their results reused
+	ResumeState resume_state;
+	std::optional<CheckpointWriter> checkpoint;
+	if (resume && checkpoint_file_name.empty())
+	{
+		std::cerr << "--resume needs the log given with --checkpoint <file>." << std::endl;
+		return 1;
+	}
+	try
+	{
+		resume_state = resume ? load_checkpoint(checkpoint_file_name, data) : ResumeState();
+		resume_state.completed.resize(data.size());
+		if (!checkpoint_file_name.empty())
+			checkpoint.emplace(checkpoint_file_name, data, resume_state.valid_bytes);
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << e.what() << " Closing the program." << std::endl;
+		return 1;
+	}
+	if (resume)
+		std::cout << "Resuming: " << resume_state.completed_count << " of " << data.size() << " records were done already." << std::endl;
 
-#pragma omp critical
+	// with --affinity the threads pin themselves, instead of relying on OMP_PROC_BIND/OMP_PLACES
+	const CpuTopology cpu_topology = detect_topology();
+	print_topology(cpu_topology, std::cout);
+	const PlacementPlan plan = plan_placement(cpu_topology, placement, omp_get_max_threads(), avoid_smt);
+	print_placement(plan, std::cout);
+
+	// the kept results live in the run arena, which is freed in one go when main returns
+	RunArena arena;
+	// The results and sums are reductions of the parallel region below, so it has no critical
+	// sections: with --top-k every thread keeps its K youngest results and the heaps are merged,
+	// otherwise the threads' sorted runs are. The resumed results and sums are the starting values.
+	SortedRun sorted_run;
+	TopK<PersonWithChangedData, Younger> top_results(top_k, Younger(), arena.shared());
+	int id_sum = 0;
+	double age_sum = 0;
+	for (auto &result : resume_state.results)
+	{
+		id_sum += result.id;
+		age_sum += result.age;
+		if (top_k > 0)
+			top_results.push(result);
+		else
+			sorted_run.items.push_back(result);
+	}
+	sorted_run.finish(SortMethod::Std);
+	// records done and busy time per thread, for the load balance report
+	std::vector<CachePadded<PartialSums>> partial_sums(omp_get_max_threads());
+	// the simd kernel computes every record's new id up front, into this
+	std::vector<int> simd_ids(kernel == "simd" ? data.size() : 0);
+	const ColumnSpan<int> id_column = data.id_column();
+	const ColumnSpan<double> age_column = data.age_column();
+	// without --schedule or OMP_SCHEDULE every thread gets one contiguous block, as before
+	if (schedule)
+		omp_set_schedule(schedule->first, schedule->second);
+	else if (std::getenv("OMP_SCHEDULE") == nullptr)
+		omp_set_schedule(omp_sched_static, 0);
+	omp_sched_t schedule_kind;
+	int schedule_chunk;
+	omp_get_schedule(&schedule_kind, &schedule_chunk);
+	std::cout << "Schedule: " << schedule_name(schedule_kind, schedule_chunk) << ", " << omp_get_max_threads() << " threads." << std::endl;
+
+	const alloc_counter::Snapshot allocations_before = alloc_counter::snapshot();
+	const auto region_start = std::chrono::steady_clock::now();
+#pragma omp parallel reduction(merge_runs : sorted_run) reduction(merge_top : top_results) reduction(+ : id_sum, age_sum)
+	{
+		TRACE_SPAN("parallel region");
+		int thread_id = omp_get_thread_num();
+		if (thread_id < (int)plan.worker_cpus.size() && !pin_current_thread(plan.worker_cpus[thread_id]))
 		{
-			std::cout << "Thread2 #" << thread_id << ": processing " << (end_index - start_index) << " items from " << start_index << " to " << end_index << ".\n";
+			// one write, so the messages of different threads don't interleave
+			std::cerr << "Thread #" + std::to_string(thread_id) + ": failed to pin to CPU " + std::to_string(plan.worker_cpus[thread_id]) + ".\n";
 		}
 
-		int id_sum = 0;
-		double age_sum = 0;
-		for (int i = start_index; i < end_index; i++)
+		// sorted_run, top_results, id_sum and age_sum are the thread's private copies here
+		PartialSums &sums = partial_sums[thread_id].value;
+		if (top_k == 0)
+			sorted_run.items.reserve(data.size() / omp_get_num_threads() + 1);
+		auto accept = [&](std::size_t row, const PersonWithChangedData &p_changed)
 		{
-			PersonWithChangedData p_changed = modify_person_data(data[i]);
+			sums.processed++;
+			if (checkpoint)
+				checkpoint->record(row, p_changed);
 			if (p_changed.id < 0)
 			{
 				id_sum += p_changed.id;
 				age_sum += p_changed.age;
-				sorted_monitor.addItemSorted(p_changed);
+				if (top_k > 0)
+					top_results.push(p_changed);
+				else
+					sorted_run.add(p_changed, sort_method);
+			}
+		};
+
+		// the records (or blocks of them) are handed out as --schedule (or OMP_SCHEDULE) says; nowait
+		// lets a thread that is done sort its run while the others are still computing.
+		// the token is checked cooperatively: between records and inside the kernel
+		if (kernel == "simd")
+		{
+			// the ids are cheap next to the ages, so they are done for every row, resumed or not;
+			// the barrier at the end makes them visible to whichever thread gets a row's block
+#pragma omp for simd schedule(simd : static)
+			for (long i = 0; i < (long)data.size(); i++)
+				simd_ids[i] = modified_id(id_column[i]);
+
+			const long blocks = (data.size() + SIMD_LANES - 1) / SIMD_LANES;
+#pragma omp for schedule(runtime) nowait
+			for (long block = 0; block < blocks; block++)
+			{
+				if (cancel.is_cancelled())
+					continue;
+				// the block's rows still to do, packed into the lanes
+				long rows[SIMD_LANES];
+				double person_ages[SIMD_LANES], ages[SIMD_LANES];
+				int count = 0;
+				for (long i = block * SIMD_LANES; i < std::min<long>((block + 1) * SIMD_LANES, data.size()); i++)
+					if (!resume_state.completed[i])
+					{
+						rows[count] = i;
+						person_ages[count++] = age_column[i];
+					}
+				bool done;
+				{
+					TRACE_SPAN("compute");
+					ScopedTimer timer(sums.busy_ms);
+					done = modified_ages(person_ages, ages, count, cancel);
+				}
+				if (!done)
+					continue;
+				for (int l = 0; l < count; l++)
+				{
+					PersonWithChangedData p_changed;
+					p_changed.originalData = data[rows[l]];
+					p_changed.id = simd_ids[rows[l]];
+					p_changed.age = ages[l];
+					p_changed.name = modified_name(p_changed.originalData);
+					accept(rows[l], p_changed);
+				}
 			}
 		}
+		else
+		{
+#pragma omp for schedule(runtime) nowait
+			for (long i = 0; i < (long)data.size(); i++)
+			{
+				if (resume_state.completed[i] || cancel.is_cancelled())
+					continue;
+				std::optional<PersonWithChangedData> p_changed;
+				{
+					TRACE_SPAN("compute");
+					ScopedTimer timer(sums.busy_ms);
+					p_changed = modify_person_data(data[i], cancel);
+				}
+				if (p_changed)
+					accept(i, *p_changed);
+			}
+		}
+		{
+			TRACE_SPAN("sort");
+			sorted_run.finish(sort_method);
+		}
+	}
+	print_load_balance(partial_sums, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - region_start).count(), std::cout);
 
-#pragma omp atomic
-		full_id_sum += id_sum;
-#pragma omp atomic
-		full_age_sum += age_sum;
+	const long allocations = alloc_counter::snapshot().allocations - allocations_before.allocations;
+	std::cout << "Heap allocations while processing: " << allocations << " (" << (double)allocations / data.size() << " per record)." << std::endl;
+	std::cout << "Run arena: " << arena.heap_bytes() << " bytes in " << arena.heap_blocks() << " heap blocks." << std::endl;
+
+	if (watchdog)
+		watchdog->stop();
+	if (checkpoint)
+	{
+		checkpoint->close();
+		checkpoint->print_summary(std::cout);
 	}
 
-	save_persons_table(data, results_file_name, "Original people's data", false);
-	save_modified_persons_table(sorted_monitor.getItems(), results_file_name, "Modified people's data, filtered by ID, sorted by age", true, full_id_sum, full_age_sum);
+	long processed = resume_state.completed_count;
+	for (auto &slot : partial_sums)
+		processed += slot.value.processed;
+
+	{
+		TRACE_SPAN("save");
+		save_persons_table(data, results_file_name, "Original people's data", false);
+		if (top_k > 0)
+			save_modified_persons_table(top_results.sorted(), results_file_name, "Modified people's data, filtered by ID, " + std::to_string(top_k) + " youngest",
+										true, id_sum, age_sum);
+		else
+			save_modified_persons_table(sorted_run.items, results_file_name, "Modified people's data, filtered by ID, sorted by age", true, id_sum, age_sum);
+		if (cancel.is_cancelled())
+			append_partial_marker(results_file_name, data.size() - processed, data.size());
+	}
 	return 0;
 }
\ No newline at end of file
@@ -4,403 +4,711 @@
 #include <thread>
 #include <random>
 #include <condition_variable>
-
+#include <memory>
+#include <atomic>
+#include <optional>
+
+#include "alloc_counter.hpp"
+#include "arena.hpp"
+#include "batch.hpp"
+#include "cancellation.hpp"
+#include "checkpoint.hpp"
+#include "coro.hpp"
+#include "engine.hpp"
 #include "json.hpp"
+#include "instrumentation.hpp"
+#include "monitors.hpp"
+#include "person_formats.hpp"
+#include "person_table.hpp"
+#include "shard.hpp"
+#include "topology.hpp"
+#include "trace.hpp"
 using json = nlohmann::json;
 
-std::condition_variable cv;
-
-struct Person
-{
-	int id;
-	double age;
-	std::string name;
-};
-
-struct PersonWithChangedData
+// cpu - the CPU to pin the thread to, -1 to leave it to the scheduler
+// checkpoint - where finished records are logged, nullptr without --checkpoint
+void worker_thread(DataMonitor &data_monitor, SortedResultMonitor &sorted_result_monitor, PipelineStats &stats, const CancellationToken &cancel,
+				   CheckpointWriter *checkpoint, int cpu)
 {
-	Person originalData;
-	int id;
-	double age;
-	std::string name;
-};
-
-class DataMonitor
-{
-public:
-	DataMonitor(int size, bool &data_exists)
+	if (!pin_current_thread(cpu))
+		std::cerr << "Thread #" << std::this_thread::get_id() << ": failed to pin to CPU " << cpu << "." << std::endl;
+	ThreadStats &thread_stats = stats.register_thread("worker");
+	TRACE_THREAD_NAME("worker");
+	while (true)
 	{
-		if (size < 1)
+		std::optional<QueuedPerson> item;
 		{
-			throw std::runtime_error("Incorrect initial given size to a DataMonitor. Initial size has to be at least 1.");
+			TRACE_SPAN("dequeue");
+			item = data_monitor.removeItem();
 		}
-
-		if (!data_exists)
-			throw std::runtime_error("DataMonitor cannot be created if there is no data to begin with.");
-
-		persons = new Person[size];
-		this->size = size;
-		this->size_used = 0;
-		this->data_exists = data_exists;
-	}
-	~DataMonitor()
-	{
-		delete[] persons;
-	}
-	void notify_workers_no_data()
-	{
+		if (!item)
 		{
-			std::lock_guard<std::mutex> lock(monitor_mtx);
-			data_exists = false;
+			std::cout << "Thread #" << std::this_thread::get_id() << ": there will not be data added anymore. Stopping work." << std::endl;
+			break;
 		}
-		cv.notify_all();
-	}
 
-	void addItem(Person item)
-	{
+		std::optional<PersonWithChangedData> p_changed;
 		{
-			std::unique_lock<std::mutex> lock(monitor_mtx);
-			cv.wait(lock, [this]
-					{ return size_used < size; }); // wait until there is space in the data_monitor
-			persons[size_used] = item;
-			size_used++;
+			TRACE_SPAN("compute");
+			ScopedTimer timer(thread_stats.compute_ms);
+			p_changed = modify_person_data(item->person, cancel);
 		}
-		cv.notify_all(); // notify that there is an item added to the data_monitor
-	}
-	Person removeItem()
-	{
+		if (!p_changed)
 		{
-			std::unique_lock<std::mutex> lock(monitor_mtx);
-			cv.wait(lock, [this]
-					{ return size_used > 0 || !data_exists; });
-			if (!data_exists && size_used == 0)
-				return Person();
-
-			if (size_used > 0)
-				size_used--;
+			std::cout << "Thread #" << std::this_thread::get_id() << ": the run was cancelled. Stopping work." << std::endl;
+			break;
+		}
+		thread_stats.items_processed++;
+		if (checkpoint != nullptr)
+			checkpoint->record(item->row, *p_changed);
+		if (p_changed->id < 0)
+		{
+			std::cout << std::endl
+					  << "Thread #" << std::this_thread::get_id() << ": adding modified item to sorted results monitor." << std::endl;
+			TRACE_SPAN("insert");
+			sorted_result_monitor.addItemSorted(*p_changed);
 		}
-		cv.notify_all(); // notify that there is an item removed from the data_monitor
-		return persons[size_used];
-	}
-	bool is_full()
-	{
-		std::unique_lock<std::mutex> lock(monitor_mtx);
-		return size == size_used;
-	}
-	bool is_empty()
-	{
-		std::unique_lock<std::mutex> lock(monitor_mtx);
-		return size_used == 0;
 	}
+}
 
-	int get_size()
+// Feeds rows [begin, end) of the data into the given monitor, except the
+// ones a resumed run has completed already.
+void producer_thread(size_t begin, size_t end, int producer_id, DataMonitor &data_monitor, PipelineStats &stats,
+					 const CancellationToken &cancel, const std::vector<bool> &completed, int cpu)
+{
+	if (!pin_current_thread(cpu))
+		std::cerr << "Producer #" << producer_id << ": failed to pin to CPU " << cpu << "." << std::endl;
+	ThreadStats &thread_stats = stats.register_thread("producer");
+	TRACE_THREAD_NAME("producer");
+	for (size_t i = begin; i < end && !cancel.is_cancelled(); i++)
 	{
-		std::unique_lock<std::mutex> lock(monitor_mtx);
-		return size;
+		if (completed[i])
+			continue;
+		std::cout << std::endl
+				  << "Producer #" << producer_id << ": adding a person to data monitor." << std::endl;
+		TRACE_SPAN("enqueue");
+		data_monitor.addItem(i);
+		thread_stats.items_processed++;
 	}
+}
 
-private:
-	Person *persons;
-	int size;
-	int size_used;
-	std::mutex monitor_mtx;
-	bool data_exists;
-};
-
-class SortedResultMonitor
+// The same pipeline as coroutines (--pipeline coro): the producers, workers and
+// the sorted insert are stages connected by channels and multiplexed onto a
+// fixed executor pool, so waiting for data suspends a stage, not a thread.
+coro::Task<> produce_stage(const PersonTable &data, size_t begin, size_t end, const std::vector<bool> &completed, coro::Channel<QueuedPerson> &persons,
+						   std::atomic<int> &producers_left)
 {
-public:
-	SortedResultMonitor(int size)
-	{
-		if (size < 1)
-		{
-			throw std::runtime_error("Incorrect initial given size to a SortedResultMonitor. Initial size has to be at least 1.");
-		}
+	// a send fails once the channel is closed by a cancellation
+	for (size_t i = begin; i < end; i++)
+		if (!completed[i] && !co_await persons.send(QueuedPerson{(std::uint32_t)i, data[i]}))
+			break;
+	if (--producers_left == 0)
+		persons.close();
+}
 
-		persons = new PersonWithChangedData[size];
-		this->size = size;
-		this->size_used = 0;
-	}
-	~SortedResultMonitor()
-	{
-		delete[] persons;
-	}
-	int addItemSorted(PersonWithChangedData item)
+coro::Task<> worker_stage(coro::Channel<QueuedPerson> &persons, coro::Channel<PersonWithChangedData> &results, std::atomic<int> &workers_left,
+						  PipelineStats &stats, const CancellationToken &cancel, CheckpointWriter *checkpoint)
+{
+	while (std::optional<QueuedPerson> item = co_await persons.receive())
 	{
+		if (cancel.is_cancelled())
+			break;
+		// the stage may continue on another thread after every co_await, so the statistics are looked up each time
+		ThreadStats &thread_stats = stats.current();
+		std::optional<PersonWithChangedData> p_changed;
 		{
-			std::unique_lock<std::mutex> lock(monitor_mtx);
-			if (size_used == size)
-			{
-				return -1; // SortedResultMonitor is full
-			}
-
-			// find the position to place the item, and if needed push other elements forwards
-			if (size_used == 0)
-			{
-				persons[0] = item;
-			}
-			else
-			{
-				int index_to_insert = -1;
-				for (int i = 0; i < size_used; i++)
-					if (item.age < persons[i].age)
-					{
-						index_to_insert = i;
-						break;
-					}
-
-				if (index_to_insert == -1)
-					persons[size_used] = item;
-				else
-				{
-					// shift the existing persons to the right
-					for (int i = size_used; i > index_to_insert; i--)
-						persons[i] = persons[i - 1];
-
-					// insert the new person
-					persons[index_to_insert] = item;
-				}
-			}
-			size_used++;
+			TRACE_SPAN("compute");
+			ScopedTimer timer(thread_stats.compute_ms);
+			p_changed = modify_person_data(item->person, cancel);
 		}
-		cv.notify_all();
-		return 0;
+		if (!p_changed)
+			break;
+		thread_stats.items_processed++;
+		if (checkpoint != nullptr)
+			checkpoint->record(item->row, *p_changed);
+		if (p_changed->id < 0)
+			co_await results.send(*p_changed);
 	}
-	std::vector<PersonWithChangedData> getItems()
+	if (--workers_left == 0)
+		results.close();
+}
+
+coro::Task<> insert_stage(coro::Channel<PersonWithChangedData> &results, SortedResultMonitor &sorted_result_monitor)
+{
+	while (std::optional<PersonWithChangedData> p_changed = co_await results.receive())
 	{
-		std::unique_lock<std::mutex> lock(monitor_mtx);
-		std::vector<PersonWithChangedData> items;
-		for (int i = 0; i < size_used; i++)
-		{
-			items.push_back(persons[i]);
-		}
-		return items;
+		TRACE_SPAN("insert");
+		sorted_result_monitor.addItemSorted(*p_changed);
 	}
+}
 
-private:
-	PersonWithChangedData *persons;
-	int size;
-	int size_used;
-	std::mutex monitor_mtx;
-	bool data_exists;
+// Runs num_stages worker stages and one producer stage per shard on num_threads executor threads.
+void run_coroutine_pipeline(const PersonTable &data, const std::vector<size_t> &shard_begin, const std::vector<bool> &completed, int num_threads,
+							int num_stages, int capacity, SortedResultMonitor &sorted_result_monitor, PipelineStats &stats, const PlacementPlan &plan,
+							CancellationToken &cancel, CheckpointWriter *checkpoint)
+{
+	coro::Executor executor(num_threads, [&](int i)
+							{
+		const int cpu = plan.worker_cpus.empty() ? -1 : plan.worker_cpus[i];
+		if (!pin_current_thread(cpu))
+			std::cerr << "Executor thread #" << i << ": failed to pin to CPU " << cpu << "." << std::endl;
+		stats.register_thread("executor");
+		TRACE_THREAD_NAME("executor"); });
+	coro::Channel<QueuedPerson> persons(executor, capacity);
+	coro::Channel<PersonWithChangedData> results(executor, capacity);
+	// closing the input wakes up the stages waiting on it; the results are still drained
+	CancellationToken::Registration close_on_cancel = cancel.on_cancel([&]
+																	   { persons.close(); });
+
+	const int num_producers = shard_begin.size() - 1;
+	std::atomic<int> producers_left(num_producers);
+	std::atomic<int> workers_left(num_stages);
+	for (int i = 0; i < num_producers; i++)
+		executor.spawn(produce_stage(data, shard_begin[i], shard_begin[i + 1], completed, persons, producers_left));
+	for (int i = 0; i < num_stages; i++)
+		executor.spawn(worker_stage(persons, results, workers_left, stats, cancel, checkpoint));
+	executor.spawn(insert_stage(results, sorted_result_monitor));
+
+	std::cout << std::endl
+			  << "Main thread: started " << num_producers << " producer and " << num_stages << " worker stages on "
+			  << num_threads << " executor threads." << std::endl;
+	executor.wait_idle();
+
+	stats.add_counter("Suspended sends", persons.get_suspended_sends() + results.get_suspended_sends());
+	stats.add_counter("Suspended receives", persons.get_suspended_receives() + results.get_suspended_receives());
+	stats.add_counter("Executor idle waits", executor.get_idle_waits());
+}
+
+// Batch mode (--batch): many inputs through one executor pool. A loader stage
+// reads the files one after the other and streams their records to the shared
+// worker stages, so the next file starts while the last records of the
+// previous one are still being computed. Every file has its own result
+// monitor, and the stage that finishes a file's last record writes its
+// results file, concurrently with the rest of the batch.
+struct BatchFile
+{
+	BatchInput paths;
+	PersonTable data;
+	std::unique_ptr<SortedResultMonitor> results;
+	std::atomic<long> remaining{0};
 };
 
-void save_persons_table(const std::vector<Person> &data, const std::string &file_name, const std::string &title, const bool &append)
+struct BatchItem
 {
-	std::cout << "saving " << data.size() << " persons.\n";
+	BatchFile *file;
+	size_t row;
+};
 
-	std::ofstream o;
-	if (append)
-		o.open(file_name, std::ios_base::app);
-	else
-		o.open(file_name);
+void write_batch_file(BatchFile &file, int top_k)
+{
+	TRACE_SPAN("save");
+	save_persons_table(file.data, file.paths.output, "Original people's data", false);
+	const std::string title = top_k > 0 ? "Modified people's data, filtered by ID, " + std::to_string(top_k) + " youngest"
+										: "Modified people's data, filtered by ID, sorted by age";
+	save_modified_persons_table(file.results->getItems(), file.paths.output, title, true);
+	std::cout << "Batch: wrote the results of '" << file.paths.input << "' to '" << file.paths.output << "'." << std::endl;
+	// nothing refers to the file's records any more
+	file.results.reset();
+	file.data = PersonTable();
+}
 
-	if (data.size() > 0)
+coro::Task<> batch_load_stage(std::vector<std::unique_ptr<BatchFile>> &files, coro::Channel<BatchItem> &items, PipelineStats &stats,
+							  WaitMode wait_mode, int top_k, SortMethod sort_method, std::atomic<int> &failed)
+{
+	for (auto &file : files)
 	{
-		o << "_________________________________________________________" << std::endl;
-		o << "| " << std::setw(52) << title << " |" << std::endl;
-		o << "|-------------------------------------------------------|" << std::endl;
-		o << "| ID          | Name                           | Age    |" << std::endl;
-		o << "|-------------------------------------------------------|" << std::endl;
-		for (auto &p : data)
+		try
 		{
-			o << "| " << std::setw(11) << p.id << " | " << std::setw(30) << p.name << " | " << std::setw(6) << p.age << " |" << std::endl;
+			TRACE_SPAN("load");
+			file->data = load_persons_file(file->paths.input);
 		}
-		o << "|-------------------------------------------------------|" << std::endl;
-		o << std::endl;
-	}
-	else
-	{
-		o << "No people's data. Either there was no data to begin with, or all of it was filtered." << std::endl;
+		catch (const std::exception &e)
+		{
+			std::cerr << "Batch: skipping '" << file->paths.input << "': " << e.what() << std::endl;
+			failed++;
+			continue;
+		}
+		if (file->data.empty())
+		{
+			std::cerr << "Batch: skipping '" << file->paths.input << "': there is no data in it." << std::endl;
+			failed++;
+			continue;
+		}
+		// once the last row is sent, a worker may finish the file and reset its data
+		const size_t rows = file->data.size();
+		file->results = std::make_unique<SortedResultMonitor>(rows, &stats, wait_mode, std::pmr::get_default_resource(), top_k, sort_method);
+		file->remaining = rows;
+		for (size_t row = 0; row < rows; row++)
+			co_await items.send(BatchItem{file.get(), row});
 	}
-	o.close();
+	items.close();
 }
 
-void save_modified_persons_table(const std::vector<PersonWithChangedData> &data, const std::string &file_name, const std::string &title, const bool &append)
+coro::Task<> batch_worker_stage(coro::Channel<BatchItem> &items, PipelineStats &stats, const CancellationToken &cancel, int top_k)
 {
-	std::cout << "saving " << data.size() << " modified persons.\n";
-
-	std::ofstream o;
-	if (append)
-		o.open(file_name, std::ios_base::app);
-	else
-		o.open(file_name);
-
-	if (data.size() > 0)
+	while (std::optional<BatchItem> item = co_await items.receive())
 	{
-		o << "_________________________________________________________" << std::endl;
-		o << "| " << std::setw(52) << title << " |" << std::endl;
-		o << "|-------------------------------------------------------|" << std::endl;
-		o << "| ID          | Name                           | Age    |" << std::endl;
-		o << "|-------------------------------------------------------|" << std::endl;
-		for (auto &p : data)
+		BatchFile &file = *item->file;
+		ThreadStats &thread_stats = stats.current();
+		std::optional<PersonWithChangedData> p_changed;
 		{
-			o << "| " << std::setw(11) << p.id << " | " << std::setw(30) << p.name << " | " << std::setw(6) << p.age << " |" << std::endl;
+			TRACE_SPAN("compute");
+			ScopedTimer timer(thread_stats.compute_ms);
+			p_changed = modify_person_data(file.data[item->row], cancel);
 		}
-		o << "|-------------------------------------------------------|" << std::endl;
-		o << std::endl;
-	}
-	else
-	{
-		o << "No modified people's data. Either there was no data to begin with, or all of it was filtered." << std::endl;
+		thread_stats.items_processed++;
+		if (p_changed->id < 0)
+		{
+			TRACE_SPAN("insert");
+			file.results->addItemSorted(*p_changed);
+		}
+		if (--file.remaining == 0)
+			write_batch_file(file, top_k);
 	}
-	o.close();
 }
 
-std::vector<Person> load_json_file(const std::string &file_name)
+// Returns the exit code: 1 if any input couldn't be processed.
+int run_batch(const std::vector<BatchInput> &inputs, int num_threads, int num_stages, int capacity, WaitMode wait_mode, int top_k,
+			  SortMethod sort_method, PipelineStats &stats)
 {
-	std::ifstream f(file_name);
-	if (!f.is_open())
+	std::vector<std::unique_ptr<BatchFile>> files;
+	for (auto &input : inputs)
 	{
-		std::cerr << "Failed to open given '" << file_name << "' file." << std::endl;
-		return std::vector<Person>();
+		files.push_back(std::make_unique<BatchFile>());
+		files.back()->paths = input;
 	}
-	json data = json::parse(f);
-	std::vector<Person> data_vector;
-	for (auto &element : data)
+
+	const CancellationToken never_cancelled;
+	std::atomic<int> failed(0);
 	{
-		Person person;
-		element.at("id").get_to(person.id);
-		element.at("age").get_to(person.age);
-		element.at("name").get_to(person.name);
-		data_vector.push_back(person);
+		coro::Executor executor(num_threads, [&](int)
+								{
+			stats.register_thread("executor");
+			TRACE_THREAD_NAME("executor"); });
+		coro::Channel<BatchItem> items(executor, capacity);
+		executor.spawn(batch_load_stage(files, items, stats, wait_mode, top_k, sort_method, failed));
+		for (int i = 0; i < num_stages; i++)
+			executor.spawn(batch_worker_stage(items, stats, never_cancelled, top_k));
+		std::cout << "Batch: " << files.size() << " input(s), " << num_stages << " worker stages on " << num_threads << " executor threads." << std::endl;
+		executor.wait_idle();
+		stats.add_counter("Suspended sends", items.get_suspended_sends());
+		stats.add_counter("Suspended receives", items.get_suspended_receives());
+		stats.add_counter("Executor idle waits", executor.get_idle_waits());
 	}
-	f.close();
-
-	return data_vector;
+	stats.add_counter("Batch files", files.size() - failed);
+	stats.add_counter("Batch files skipped", failed);
+	return failed > 0 ? 1 : 0;
 }
 
-PersonWithChangedData modify_person_data(const Person &person)
+int main(int argc, char *argv[])
 {
-	PersonWithChangedData p;
-	p.originalData = person;
-
-	// Generate a new id with very complex calculations
-	p.id = 0;
-	for (int i = 0; i < 1000000; i++)
+	std::string file_name = "filters_some.json";
+	std::string results_file_name = "results.txt";
+	std::string stats_file_name; // optional machine-readable statistics dump
+	int num_producers = 1;
+	int requested_threads = 0; // 0 - pick a random worker count, as the task requires
+	// shared - every producer feeds one MPMC DataMonitor,
+	// per-producer - every producer has its own DataMonitor, drained by the workers assigned to it
+	std::string topology = "shared";
+	OverflowPolicy overflow_policy = OverflowPolicy::Block;
+	int requested_capacity = 0; // 0 - half of the shard, as before
+	WaitMode wait_mode = WaitMode::Block;
+	PlacementPolicy placement = PlacementPolicy::None;
+	bool avoid_smt = false;
+	int top_k = 0; // 0 - keep every result
+	SortMethod sort_method = SortMethod::Insertion;
+	bool sort_given = false; // --sort was passed, not just the default
+	// threads - a blocking thread per producer and worker, coro - coroutine stages on --threads executor threads
+	std::string pipeline = "threads";
+	int num_stages = 0; // coroutine worker stages, 0 - one per executor thread
+	double deadline_s = 0; // 0 - no deadline
+	std::string checkpoint_file_name; // log of finished records, none if empty
+	bool resume = false;			  // skip the records logged in checkpoint_file_name
+	std::vector<std::string> batch_patterns; // --batch inputs, processed instead of --input
+	std::string output_dir;					 // where batch results go, next to the inputs if empty
+	std::optional<Backend> engine_backend;	 // run the shared engine on this backend instead
+	bool compare = false;					 // run the shared engine on every backend and compare them
+	int num_processes = 0;					 // run on this many forked worker processes instead, 0 - don't
+	int claim_size = 4;						 // records a worker process claims at a time
+
+	for (int i = 1; i < argc; i++)
 	{
-		p.id += person.id * i;
-		for (int j = 0; j < 100; j++)
+		std::string arg = argv[i];
+		if (arg == "--stats-json" && i + 1 < argc)
+			stats_file_name = argv[++i];
+		else if (arg == "--trace" && i + 1 < argc)
+			trace::enable(argv[++i]);
+		else if (arg == "--input" && i + 1 < argc)
+			file_name = argv[++i];
+		else if (arg == "--producers" && i + 1 < argc)
+			num_producers = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--threads" && i + 1 < argc)
+			requested_threads = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--topology" && i + 1 < argc && (std::string(argv[i + 1]) == "shared" || std::string(argv[i + 1]) == "per-producer"))
+			topology = argv[++i];
+		else if (arg == "--overflow" && i + 1 < argc && parse_overflow_policy(argv[i + 1], overflow_policy))
+			i++;
+		else if (arg == "--capacity" && i + 1 < argc)
+			requested_capacity = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--wait" && i + 1 < argc && parse_wait_mode(argv[i + 1], wait_mode))
+			i++;
+		else if (arg == "--affinity" && i + 1 < argc && parse_placement_policy(argv[i + 1], placement))
+			i++;
+		else if (arg == "--no-smt")
+			avoid_smt = true;
+		else if (arg == "--top-k" && i + 1 < argc)
+			top_k = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--sort" && i + 1 < argc && parse_sort_method(argv[i + 1], sort_method))
+		{
+			i++;
+			sort_given = true;
+		}
+		else if (arg == "--pipeline" && i + 1 < argc && (std::string(argv[i + 1]) == "threads" || std::string(argv[i + 1]) == "coro"))
+			pipeline = argv[++i];
+		else if (arg == "--stages" && i + 1 < argc)
+			num_stages = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--deadline" && i + 1 < argc)
+			deadline_s = std::stod(argv[++i]);
+		else if (arg == "--checkpoint" && i + 1 < argc)
+			checkpoint_file_name = argv[++i];
+		else if (arg == "--resume")
+			resume = true;
+		else if (arg == "--batch" && i + 1 < argc)
+			batch_patterns.push_back(argv[++i]);
+		else if (arg == "--output-dir" && i + 1 < argc)
+			output_dir = argv[++i];
+		else if (arg == "--backend" && i + 1 < argc && parse_backend(argv[i + 1], engine_backend.emplace()))
+			i++;
+		else if (arg == "--compare")
+			compare = true;
+		else if (arg == "--processes" && i + 1 < argc)
+			num_processes = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--claim" && i + 1 < argc)
+			claim_size = std::max(1, std::stoi(argv[++i]));
+		else
 		{
-			p.id += i * j;
+			std::cerr << "Unknown argument '" << arg << "'. Usage: " << argv[0]
+					  << " [--input <file>] [--threads N] [--producers N] [--topology shared|per-producer]"
+					  << " [--capacity N] [--overflow block|drop-oldest|drop-newest|spill] [--wait block|spin]"
+					  << " [--affinity none|compact|scatter] [--no-smt] [--top-k K] [--sort insert|radix|std]"
+					  << " [--pipeline threads|coro] [--stages N] [--deadline <seconds>]"
+					  << " [--checkpoint <file> [--resume]] [--batch <file|pattern|@list>]... [--output-dir <dir>]"
+					  << " [--backend serial|threads|omp-static|omp-dynamic|omp-guided|work-stealing] [--compare]"
+					  << " [--processes N [--claim N]] [--stats-json <file>] [--trace <file>]" << std::endl;
+			return 1;
 		}
 	}
-	p.id /= 100000000;
+	trace::enable_from_env();
+	TRACE_THREAD_NAME("main");
 
-	// Generate a new age with very complex calculations
-	p.age = person.age;
-	for (int i = 0; i < 1000000; i++)
+	if (!batch_patterns.empty())
 	{
-		if (p.age < 0)
-			p.age += -p.age * 3.1425;
-		else
-			p.age += p.age * 3.1425;
-		for (int j = 0; j < 100; j++)
+		if (deadline_s > 0 || !checkpoint_file_name.empty())
 		{
-			p.age += i + j;
+			std::cerr << "--batch can't be combined with --deadline or --checkpoint." << std::endl;
+			return 1;
 		}
-		if (p.age < 0 || p.age > 10000)
+		std::vector<BatchInput> inputs;
+		try
 		{
-			p.age = person.age;
+			inputs = plan_batch(expand_batch_patterns(batch_patterns), output_dir, results_file_name);
+			if (!output_dir.empty())
+				std::filesystem::create_directories(output_dir);
 		}
+		catch (const std::exception &e)
+		{
+			std::cerr << e.what() << " Closing the program." << std::endl;
+			return 1;
+		}
+		const int threads = requested_threads > 0 ? requested_threads : std::max(1u, std::thread::hardware_concurrency());
+		const int stages = num_stages > 0 ? num_stages : threads;
+		PipelineStats stats;
+		const int code = run_batch(inputs, threads, stages, requested_capacity > 0 ? requested_capacity : 2 * stages, wait_mode, top_k, sort_method, stats);
+		stats.print_summary(std::cout);
+		if (!stats_file_name.empty())
+			stats.dump_json(stats_file_name);
+		return code;
 	}
 
-	// Generate a new name with very complex calculations
-	p.name = "";
-	for (int i = 0; i < 10; i++)
+	// the deadline counts from the start of the run; when it passes, the run stops and saves what it has
+	CancellationToken cancel;
+	std::optional<DeadlineWatchdog> watchdog;
+	if (deadline_s > 0)
+		watchdog.emplace(cancel, deadline_s);
+
+	PipelineStats stats;
+	PersonTable data;
 	{
-		char randomChar = (char)((int)pow(person.id + i, 4) % 25 + 'A'); // Generate 'A' to 'Z'
-		p.name += randomChar;
-		for (int j = 0; j < 2; j++)
+		TRACE_SPAN("load");
+		data = load_persons_file(file_name);
+	}
+	std::cout << "Loaded " << data.size() << " persons from '" << file_name << "'." << std::endl;
+	bool data_exists = data.size() > 0;
+	if (!data_exists)
+	{
+		std::cerr << "There is no data in '" + file_name + "'. Closing the program." << std::endl;
+		return 1;
+	}
+
+	// --backend/--compare: the shared engine instead of this program's own pipeline
+	if (engine_backend || compare)
+	{
+		// the engine collects every result and sorts them once with std::sort, so it has no use for these
+		if (deadline_s > 0 || !checkpoint_file_name.empty() || top_k > 0 || sort_given || num_processes > 0)
+		{
+			std::cerr << "--backend and --compare can't be combined with --deadline, --checkpoint, --top-k, --sort or --processes." << std::endl;
+			return 1;
+		}
+		const int threads = requested_threads > 0 ? requested_threads : std::max(1u, std::thread::hardware_concurrency());
+		try
+		{
+			if (compare)
+				return compare_backends(data, threads, std::cout) ? 0 : 1;
+			EngineResult run = run_engine(data, *engine_backend, threads);
+			std::cout << "Engine: " << backend_name(*engine_backend) << " backend, " << run.threads << " threads, " << run.elapsed_ms << " ms." << std::endl;
+			save_persons_table(data, results_file_name, "Original people's data", false);
+			save_modified_persons_table(run.results, results_file_name, "Modified people's data, filtered by ID, sorted by age", true);
+		}
+		catch (const std::exception &e)
 		{
-			randomChar = (char)((int)pow(person.age + i * j, 5) % 25 + 'A'); // Generate 'A' to 'Z'
-			p.name += randomChar;
+			std::cerr << e.what() << " Closing the program." << std::endl;
+			return 1;
 		}
+		return 0;
 	}
 
-	return p;
-}
-
-void worker_thread(DataMonitor &data_monitor, SortedResultMonitor &sorted_result_monitor)
-{
-	while (true)
+	// --processes: forked worker processes over shared memory instead of threads;
+	// LAB1_CRASH_WORKER=<index> makes that worker of the first round abort, to try the recovery out
+	if (num_processes > 0)
 	{
-		Person p = data_monitor.removeItem();
-		if (p.name.length() == 0)
+		if (deadline_s > 0 || !checkpoint_file_name.empty() || resume)
 		{
-			std::cout << "Thread #" << std::this_thread::get_id() << ": there will not be data added anymore. Stopping work." << std::endl;
-			break;
+			std::cerr << "--processes can't be combined with --deadline, --checkpoint or --resume." << std::endl;
+			return 1;
 		}
-
-		PersonWithChangedData p_changed = modify_person_data(p);
-		if (p_changed.id < 0)
+		const char *crash_worker = std::getenv("LAB1_CRASH_WORKER");
+		const PlacementPlan plan = plan_placement(detect_topology(), placement, num_processes, avoid_smt);
+		try
 		{
-			std::cout << std::endl
-					  << "Thread #" << std::this_thread::get_id() << ": adding modified item to sorted results monitor." << std::endl;
-			sorted_result_monitor.addItemSorted(p_changed);
+			const auto started = std::chrono::steady_clock::now();
+			ShardReport report = run_sharded(data, num_processes, claim_size, plan.worker_cpus, std::cout, crash_worker ? std::stoi(crash_worker) : -1);
+			const double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+			std::cout << "Sharded: " << num_processes << " worker processes, " << report.rounds << " rounds, " << report.crashed_workers
+					  << " crashed, " << report.rerun_records << " records run again, " << elapsed_ms << " ms." << std::endl;
+			sort_results(report.results, sort_method == SortMethod::Insertion ? SortMethod::Std : sort_method);
+			const std::string title = top_k > 0 ? "Modified people's data, filtered by ID, " + std::to_string(top_k) + " youngest"
+												: "Modified people's data, filtered by ID, sorted by age";
+			if (top_k > 0 && (int)report.results.size() > top_k)
+				report.results.resize(top_k);
+			save_persons_table(data, results_file_name, "Original people's data", false);
+			save_modified_persons_table(report.results, results_file_name, title, true);
 		}
+		catch (const std::exception &e)
+		{
+			std::cerr << e.what() << " Closing the program." << std::endl;
+			return 1;
+		}
+		return 0;
 	}
-}
 
-int main()
-{
-	std::string file_name = "filters_some.json";
-	std::string results_file_name = "results.txt";
-	std::vector<Person> data = load_json_file(file_name);
-	std::cout << "Loaded " << data.size() << " persons from '" << file_name << "'." << std::endl;
-	bool data_exists = data.size() > 0;
-	if (!data_exists)
+	// with --resume the records an earlier run logged are skipped and their results reused
+	ResumeState resume_state;
+	std::optional<CheckpointWriter> checkpoint;
+	if (resume && checkpoint_file_name.empty())
 	{
-		std::cerr << "There is no data in '" + file_name + "'. Closing the program." << std::endl;
+		std::cerr << "--resume needs the log given with --checkpoint <file>." << std::endl;
+		return 1;
+	}
+	try
+	{
+		resume_state = resume ? load_checkpoint(checkpoint_file_name, data) : ResumeState();
+		resume_state.completed.resize(data.size());
+		if (!checkpoint_file_name.empty())
+			checkpoint.emplace(checkpoint_file_name, data, resume_state.valid_bytes);
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << e.what() << " Closing the program." << std::endl;
 		return 1;
 	}
+	CheckpointWriter *checkpoint_writer = checkpoint ? &*checkpoint : nullptr;
+	if (resume)
+		std::cout << "Resuming: " << resume_state.completed_count << " of " << data.size() << " records were done already." << std::endl;
 
-	DataMonitor data_monitor(data.size() / 2 - 1, std::ref(data_exists));
-	SortedResultMonitor sorted_monitor(data.size());
+	// the monitors' slots live in the run arena, which is freed in one go when main returns
+	RunArena arena;
+	SortedResultMonitor sorted_monitor(data.size(), &stats, wait_mode, arena.shared(), top_k, sort_method);
+	for (auto &result : resume_state.results)
+		sorted_monitor.addItemSorted(result);
 
 	// Create worker threads that will check if data exists then
 	// it will wait until that data gets added to the DataMonitor.
 	// For this task there has to be 2 <= x <= n/4 threads,
-	// with n being the number of Person objects in the data vector.
+	// with n being the number of rows in the data table.
 	// Here the x will be a random number between 2 and either
 	// n/4 or max number of threads the machine can handle.
 	const int max_threads = std::thread::hardware_concurrency() - 1 > data.size() / 4 ? std::thread::hardware_concurrency() - 1 : data.size();
 	std::random_device rd;
 	std::mt19937 gen(rd());
 	std::uniform_int_distribution<int> dist(2, max_threads);
-	const int num_threads = dist(gen);
+	const int num_threads = requested_threads > 0 ? requested_threads : dist(gen);
 	// const int num_threads = 2; // for testing purposes
 
-	std::vector<std::thread> threads;
-	for (int i = 0; i < num_threads; i++)
+	// Split the input into one contiguous shard per producer. With the
+	// per-producer topology every queue needs at least one worker, so there
+	// can't be more producers than workers.
+	num_producers = std::min<size_t>(num_producers, data.size());
+	if (topology == "per-producer" && num_producers > num_threads)
 	{
-		threads.emplace_back(worker_thread, std::ref(data_monitor), std::ref(sorted_monitor));
+		std::cout << "Main thread: only " << num_threads << " workers, using " << num_threads << " producers instead of " << num_producers << "." << std::endl;
+		num_producers = num_threads;
 	}
+	std::vector<size_t> shard_begin(num_producers + 1);
+	for (int i = 0; i <= num_producers; i++)
+		shard_begin[i] = data.size() * i / num_producers;
 
-	std::cout << std::endl
-			  << "Main thread: created threads." << std::endl;
+	std::vector<std::unique_ptr<DataMonitor>> data_monitors;
+	if (topology == "shared")
+	{
+		const int capacity = requested_capacity > 0 ? requested_capacity : std::max<int>(1, data.size() / 2 - 1);
+		data_monitors.push_back(std::make_unique<DataMonitor>(data, capacity, std::ref(data_exists), &stats, overflow_policy, wait_mode, arena.shared()));
+	}
+	else
+		for (int i = 0; i < num_producers; i++)
+		{
+			const int shard_size = shard_begin[i + 1] - shard_begin[i];
+			const int capacity = requested_capacity > 0 ? requested_capacity : std::max(1, shard_size / 2 - 1);
+			data_monitors.push_back(std::make_unique<DataMonitor>(data, capacity, std::ref(data_exists), &stats, overflow_policy, wait_mode, arena.shared()));
+		}
+
+	// every producer gets a core of its own, the workers are placed on the remaining ones
+	const CpuTopology cpu_topology = detect_topology();
+	print_topology(cpu_topology, std::cout);
+	const PlacementPlan plan = plan_placement(cpu_topology, placement, num_threads, avoid_smt, pipeline == "coro" ? 0 : num_producers);
+	print_placement(plan, std::cout);
+	auto worker_cpu = [&](int i)
+	{ return plan.worker_cpus.empty() ? -1 : plan.worker_cpus[i]; };
+	auto producer_cpu = [&](int i)
+	{ return i < (int)plan.reserved_cpus.size() ? plan.reserved_cpus[i] : -1; };
+
+	const alloc_counter::Snapshot allocations_before = alloc_counter::snapshot();
 
-	for (auto &p : data)
+	if (pipeline == "coro")
+	{
+		const int capacity = requested_capacity > 0 ? requested_capacity : std::max<int>(1, data.size() / 2 - 1);
+		run_coroutine_pipeline(data, shard_begin, resume_state.completed, num_threads, num_stages > 0 ? num_stages : num_threads, capacity,
+							   sorted_monitor, stats, plan, cancel, checkpoint_writer);
+	}
+	else
 	{
+		CancellationToken::Registration wake_on_cancel = cancel.on_cancel([&]
+																		  {
+			for (auto &data_monitor : data_monitors)
+				data_monitor->cancel(); });
+
+		// worker i drains queue i % queue count, so with one shared queue everyone drains it
+		std::vector<std::thread> threads;
+		for (int i = 0; i < num_threads; i++)
+		{
+			threads.emplace_back(worker_thread, std::ref(*data_monitors[i % data_monitors.size()]), std::ref(sorted_monitor), std::ref(stats), std::cref(cancel),
+								 checkpoint_writer, worker_cpu(i));
+		}
+
 		std::cout << std::endl
-				  << "Main thread: adding a person to data monitor." << std::endl;
-		data_monitor.addItem(p);
+				  << "Main thread: created " << num_threads << " threads, " << num_producers << " producers, "
+				  << data_monitors.size() << " " << topology << " queue(s)." << std::endl;
+
+		std::vector<std::thread> producers;
+		for (int i = 0; i < num_producers; i++)
+		{
+			producers.emplace_back(producer_thread, shard_begin[i], shard_begin[i + 1], i,
+								   std::ref(*data_monitors[i % data_monitors.size()]), std::ref(stats), std::cref(cancel),
+								   std::cref(resume_state.completed), producer_cpu(i));
+		}
+		for (auto &producer : producers)
+		{
+			producer.join();
+		}
+
+		std::cout << "Main thread: all producers finished." << std::endl;
+
+		for (auto &data_monitor : data_monitors)
+			data_monitor->notify_workers_no_data();
+
+		std::cout << "Main thread: waiting for threads to join." << std::endl;
+
+		for (auto &thread : threads)
+		{
+			thread.join();
+		}
 	}
 
-	std::cout << "Main thread: there are " << data_monitor.get_size() << " items left in the data monitor." << std::endl;
+	// the deadline can't cancel anything from here on, whatever was collected is saved
+	if (watchdog)
+		watchdog->stop();
+	if (checkpoint)
+	{
+		checkpoint->close();
+		checkpoint->print_summary(std::cout);
+		stats.add_counter("Checkpointed records", checkpoint->get_stats().records);
+	}
+	const bool partial = cancel.is_cancelled();
+	const long unprocessed = data.size() - resume_state.completed_count - stats.total_items(pipeline == "coro" ? "executor" : "worker");
+	if (partial)
+		stats.add_counter("Unprocessed records (deadline)", unprocessed);
 
-	data_monitor.notify_workers_no_data();
+	const long allocations = alloc_counter::snapshot().allocations - allocations_before.allocations;
+	std::cout << "Heap allocations while processing: " << allocations << " (" << (double)allocations / data.size() << " per record)." << std::endl;
+	std::cout << "Run arena: " << arena.heap_bytes() << " bytes in " << arena.heap_blocks() << " heap blocks." << std::endl;
+	stats.add_counter("Run arena heap blocks", arena.heap_blocks());
 
-	std::cout << "Main thread: waiting for threads to join." << std::endl;
+	if (overflow_policy != OverflowPolicy::Block)
+	{
+		OverflowCounters total;
+		for (auto &data_monitor : data_monitors)
+		{
+			OverflowCounters counters = data_monitor->get_overflow_counters();
+			total.dropped_oldest += counters.dropped_oldest;
+			total.dropped_newest += counters.dropped_newest;
+			total.spilled += counters.spilled;
+			total.unspilled += counters.unspilled;
+		}
+		stats.add_counter("Dropped oldest", total.dropped_oldest);
+		stats.add_counter("Dropped newest", total.dropped_newest);
+		stats.add_counter("Spilled to disk", total.spilled);
+		stats.add_counter("Read back from disk", total.unspilled);
+	}
 
-	for (auto &thread : threads)
+	if (wait_mode == WaitMode::SpinThenPark)
 	{
-		thread.join();
+		WaitStats total = sorted_monitor.get_wait_stats();
+		for (auto &data_monitor : data_monitors)
+		{
+			WaitStats wait_stats = data_monitor->get_wait_stats();
+			total.spin_attempts += wait_stats.spin_attempts;
+			total.spin_successes += wait_stats.spin_successes;
+			total.parks += wait_stats.parks;
+		}
+		stats.add_counter("Spin waits", total.spin_attempts);
+		stats.add_counter("Spin waits that avoided parking", total.spin_successes);
+		stats.add_counter("Parked waits", total.parks);
+		std::cout << "Spin success rate: " << (total.spin_attempts > 0 ? 100.0 * total.spin_successes / total.spin_attempts : 0.0) << "%" << std::endl;
 	}
 
 	std::cout << "Main thread: threads joined, printing out the results to " << results_file_name << "." << std::endl;
 
-	save_persons_table(data, results_file_name, "Original people's data", false);
-	save_modified_persons_table(sorted_monitor.getItems(), results_file_name, "Modified people's data, filtered by ID, sorted by age", true);
+	{
+		TRACE_SPAN("save");
+		save_persons_table(data, results_file_name, "Original people's data", false);
+		const std::string title = top_k > 0 ? "Modified people's data, filtered by ID, " + std::to_string(top_k) + " youngest"
+											: "Modified people's data, filtered by ID, sorted by age";
+		save_modified_persons_table(sorted_monitor.getItems(), results_file_name, title, true);
+		if (partial)
+			append_partial_marker(results_file_name, unprocessed, data.size());
+	}
+
+	stats.print_summary(std::cout);
+	if (!stats_file_name.empty())
+		stats.dump_json(stats_file_name);
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,312 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+
+#include "monitors.hpp"
+#include "../int_monitor.hpp"
+
+// Throughput microbenchmark for DataMonitor, SortedResultMonitor and IntMonitor.
+// Every configuration of the sweep runs a trivial per-item kernel, so the numbers
+// show the cost of the monitors themselves.
+
+struct BenchmarkConfig
+{
+	int max_producers = 4;
+	int max_consumers = 4;
+	std::vector<int> capacities = {1, 16, 256};
+	int items = 50000;
+	int sorted_items = 5000; // SortedResultMonitor inserts are O(n), keep its runs short
+	int int_reads = 2000;
+	std::string csv_file_name = "monitor_benchmark.csv";
+	WaitMode wait_mode = WaitMode::Block;
+};
+
+struct BenchmarkResult
+{
+	std::string monitor;
+	std::string wait;
+	int producers;
+	int consumers;
+	int capacity;
+	int items;
+	double seconds;
+	double ops_per_sec;
+	double p50_us;
+	double p99_us;
+	long context_switches;
+};
+
+using bench_clock = std::chrono::steady_clock;
+
+long context_switches()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+double percentile(std::vector<double> &samples, double fraction)
+{
+	if (samples.empty())
+		return 0;
+	size_t index = std::min(samples.size() - 1, (size_t)(fraction * samples.size()));
+	std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+	return samples[index];
+}
+
+// "spin(<success %>)" for spinning runs, so the CSV shows how often spinning paid off
+std::string wait_mode_name(const WaitStats &stats, WaitMode wait_mode)
+{
+	if (wait_mode == WaitMode::Block)
+		return "block";
+	const double rate = stats.spin_attempts > 0 ? 100.0 * stats.spin_successes / stats.spin_attempts : 0;
+	return "spin(" + std::to_string((int)rate) + "%)";
+}
+
+double to_us(bench_clock::duration d)
+{
+	return std::chrono::duration<double, std::micro>(d).count();
+}
+
+// Producers push `items` persons through one DataMonitor, consumers pop them.
+// Handoff latency is the time from the producer calling addItem until a consumer
+// gets the item back from removeItem.
+BenchmarkResult run_data_monitor(int producers, int consumers, int capacity, int items, WaitMode wait_mode)
+{
+	PersonTable table; // the queued rows; they only carry their own index
+	for (int i = 0; i < items; i++)
+		table.push_back(i, i, "x");
+	bool data_exists = true;
+	DataMonitor monitor(table, capacity, data_exists, nullptr, OverflowPolicy::Block, wait_mode);
+	std::vector<bench_clock::time_point> enqueued_at(items);
+	std::vector<double> latencies(items);
+	std::atomic<long> checksum{0};
+
+	const long switches_before = context_switches();
+	const auto start = bench_clock::now();
+
+	std::vector<std::thread> consumer_threads;
+	for (int c = 0; c < consumers; c++)
+	{
+		consumer_threads.emplace_back([&]
+									  {
+			long sum = 0;
+			while (std::optional<QueuedPerson> item = monitor.removeItem())
+			{
+				latencies[item->row] = to_us(bench_clock::now() - enqueued_at[item->row]);
+				sum += item->person.id; // trivial kernel
+			}
+			checksum += sum; });
+	}
+
+	std::vector<std::thread> producer_threads;
+	for (int pr = 0; pr < producers; pr++)
+	{
+		producer_threads.emplace_back([&, pr]
+									  {
+			for (int i = pr; i < items; i += producers)
+			{
+				enqueued_at[i] = bench_clock::now();
+				monitor.addItem(i);
+			} });
+	}
+
+	for (auto &t : producer_threads)
+		t.join();
+	monitor.notify_workers_no_data();
+	for (auto &t : consumer_threads)
+		t.join();
+
+	const double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+	const long switches = context_switches() - switches_before;
+	if (checksum != (long)items * (items - 1) / 2)
+		std::cerr << "DataMonitor lost or duplicated items (checksum " << checksum << ")." << std::endl;
+
+	return {"DataMonitor", wait_mode_name(monitor.get_wait_stats(), wait_mode), producers, consumers, capacity, items, seconds, items / seconds,
+			percentile(latencies, 0.5), percentile(latencies, 0.99), switches};
+}
+
+// Producers insert persons with random ages into one SortedResultMonitor.
+// Latency is the duration of a single addItemSorted call.
+BenchmarkResult run_sorted_monitor(int producers, int items, WaitMode wait_mode)
+{
+	SortedResultMonitor monitor(items, nullptr, wait_mode);
+	std::vector<double> latencies(items);
+	const std::string name = "x"; // viewed by the stored originalData
+
+	const long switches_before = context_switches();
+	const auto start = bench_clock::now();
+
+	std::vector<std::thread> producer_threads;
+	for (int pr = 0; pr < producers; pr++)
+	{
+		producer_threads.emplace_back([&, pr]
+									  {
+			std::mt19937 gen(pr);
+			std::uniform_real_distribution<double> age(0, 100);
+			for (int i = pr; i < items; i += producers)
+			{
+				PersonWithChangedData p;
+				p.originalData = {i, 0, name};
+				p.id = -i;
+				p.age = age(gen);
+				p.name = name;
+				const auto insert_start = bench_clock::now();
+				monitor.addItemSorted(p);
+				latencies[i] = to_us(bench_clock::now() - insert_start);
+			} });
+	}
+	for (auto &t : producer_threads)
+		t.join();
+
+	const double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+	const long switches = context_switches() - switches_before;
+	if ((int)monitor.getItems().size() != items)
+		std::cerr << "SortedResultMonitor holds " << monitor.getItems().size() << " items instead of " << items << "." << std::endl;
+
+	return {"SortedResultMonitor", wait_mode_name(monitor.get_wait_stats(), wait_mode), producers, 0, items, items, seconds, items / seconds,
+			percentile(latencies, 0.5), percentile(latencies, 0.99), switches};
+}
+
+// Writers (producers) and readers (consumers) run the IntMonitor protocol until
+// `reads` values have been read. Latency is the duration of a writeA call, which
+// blocks until enough readers have seen the previous value.
+BenchmarkResult run_int_monitor(int writers, int readers, int reads)
+{
+	IntMonitor monitor(reads, false);
+	std::vector<std::vector<double>> writer_latencies(writers);
+
+	const long switches_before = context_switches();
+	const auto start = bench_clock::now();
+
+	std::vector<std::thread> threads;
+	for (int w = 0; w < writers; w++)
+	{
+		threads.emplace_back([&, w]
+							 {
+			int value = 11 + w * 1000;
+			while (!monitor.isFinished())
+			{
+				const auto write_start = bench_clock::now();
+				monitor.writeA(value++);
+				writer_latencies[w].push_back(to_us(bench_clock::now() - write_start));
+			} });
+	}
+	for (int r = 0; r < readers; r++)
+	{
+		threads.emplace_back([&, r]
+							 {
+			int prev_result = -1;
+			while (!monitor.isFinished())
+				prev_result = monitor.readA(prev_result, r); });
+	}
+	for (auto &t : threads)
+		t.join();
+
+	const double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+	const long switches = context_switches() - switches_before;
+
+	std::vector<double> latencies;
+	for (auto &l : writer_latencies)
+		latencies.insert(latencies.end(), l.begin(), l.end());
+
+	return {"IntMonitor", "block", writers, readers, 0, reads, seconds, reads / seconds,
+			percentile(latencies, 0.5), percentile(latencies, 0.99), switches};
+}
+
+std::vector<int> parse_int_list(const std::string &list)
+{
+	std::vector<int> values;
+	std::stringstream ss(list);
+	std::string item;
+	while (std::getline(ss, item, ','))
+		values.push_back(std::stoi(item));
+	return values;
+}
+
+void print_usage(const char *program)
+{
+	std::cerr << "Usage: " << program << " [--producers N] [--consumers N] [--capacities a,b,c]"
+			  << " [--items N] [--sorted-items N] [--int-reads N] [--wait block|spin] [--csv <file>]" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	BenchmarkConfig config;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (i + 1 >= argc)
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+		if (arg == "--producers")
+			config.max_producers = std::stoi(argv[++i]);
+		else if (arg == "--consumers")
+			config.max_consumers = std::stoi(argv[++i]);
+		else if (arg == "--capacities")
+			config.capacities = parse_int_list(argv[++i]);
+		else if (arg == "--items")
+			config.items = std::stoi(argv[++i]);
+		else if (arg == "--sorted-items")
+			config.sorted_items = std::stoi(argv[++i]);
+		else if (arg == "--int-reads")
+			config.int_reads = std::stoi(argv[++i]);
+		else if (arg == "--csv")
+			config.csv_file_name = argv[++i];
+		else if (arg == "--wait")
+		{
+			if (!parse_wait_mode(argv[++i], config.wait_mode))
+			{
+				print_usage(argv[0]);
+				return 1;
+			}
+		}
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	std::vector<BenchmarkResult> results;
+	for (int producers = 1; producers <= config.max_producers; producers++)
+		for (int consumers = 1; consumers <= config.max_consumers; consumers++)
+			for (int capacity : config.capacities)
+				results.push_back(run_data_monitor(producers, consumers, capacity, config.items, config.wait_mode));
+
+	for (int producers = 1; producers <= config.max_producers; producers++)
+		results.push_back(run_sorted_monitor(producers, config.sorted_items, config.wait_mode));
+
+	// A writer only continues once two reads of its value happened, so IntMonitor needs
+	// at least two readers. With three or more, a value read three times is reset to the
+	// initial value, which every reader has already seen, and the protocol livelocks,
+	// so the sweep always uses exactly two readers.
+	for (int writers = 1; writers <= config.max_producers; writers++)
+		results.push_back(run_int_monitor(writers, 2, config.int_reads));
+
+	std::ofstream csv(config.csv_file_name);
+	csv << "monitor,wait,producers,consumers,capacity,items,seconds,ops_per_sec,p50_us,p99_us,context_switches" << std::endl;
+	std::cout << "| Monitor             | Wait      | Prod | Cons | Capacity |    ops/sec |  p50 us |    p99 us | Ctx switches |" << std::endl;
+	std::cout << "|---------------------|-----------|------|------|----------|------------|---------|-----------|--------------|" << std::endl;
+	for (auto &r : results)
+	{
+		csv << r.monitor << "," << r.wait << "," << r.producers << "," << r.consumers << "," << r.capacity << "," << r.items << ","
+			<< r.seconds << "," << r.ops_per_sec << "," << r.p50_us << "," << r.p99_us << "," << r.context_switches << std::endl;
+		std::cout << "| " << std::setw(19) << std::left << r.monitor << " | " << std::setw(9) << r.wait << std::right << " | " << std::setw(4) << r.producers << " | " << std::setw(4) << r.consumers
+				  << " | " << std::setw(8) << r.capacity << " | " << std::fixed << std::setprecision(0) << std::setw(10) << r.ops_per_sec
+				  << " | " << std::setprecision(1) << std::setw(7) << r.p50_us << " | " << std::setw(9) << r.p99_us << " | " << std::setw(12) << r.context_switches << " |" << std::endl;
+	}
+	std::cout << "Results written to '" << config.csv_file_name << "'." << std::endl;
+	return 0;
+}
@@ -0,0 +1,423 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cache_line.hpp"
+#include "instrumentation.hpp"
+#include "person.hpp"
+#include "person_table.hpp"
+#include "radix_sort.hpp"
+#include "top_k.hpp"
+#include "wait_strategy.hpp"
+
+// What DataMonitor::addItem does when the queue is full.
+enum class OverflowPolicy
+{
+	Block,		// wait until a worker removes an item
+	DropOldest, // overwrite the oldest queued item
+	DropNewest, // discard the item being added
+	Spill		// append the item to a temporary file that is drained after the in-memory queue
+};
+
+inline bool parse_overflow_policy(const std::string &name, OverflowPolicy &policy)
+{
+	if (name == "block")
+		policy = OverflowPolicy::Block;
+	else if (name == "drop-oldest")
+		policy = OverflowPolicy::DropOldest;
+	else if (name == "drop-newest")
+		policy = OverflowPolicy::DropNewest;
+	else if (name == "spill")
+		policy = OverflowPolicy::Spill;
+	else
+		return false;
+	return true;
+}
+
+struct OverflowCounters
+{
+	long dropped_oldest = 0;
+	long dropped_newest = 0;
+	long spilled = 0;	// items written to the spill segment
+	long unspilled = 0; // items read back from the spill segment
+};
+
+// Append-only temporary file holding the items that overflowed a DataMonitor.
+// Only the row indices are stored, 4 bytes per item; DataMonitor turns them
+// back into views of its table when they are removed. Once every spilled item
+// is read back the file is rewound, so its size is bounded by the largest
+// backlog.
+class SpillSegment
+{
+public:
+	SpillSegment()
+	{
+		std::string path = (std::filesystem::temp_directory_path() / "datamonitor_spill_XXXXXX").string();
+		int fd = mkstemp(path.data());
+		if (fd == -1)
+			throw std::runtime_error("Couldn't create a DataMonitor spill file.");
+		file.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+		close(fd);
+		std::filesystem::remove(path); // the open stream keeps the file alive
+		if (!file.is_open())
+			throw std::runtime_error("Couldn't open the DataMonitor spill file '" + path + "'.");
+	}
+
+	void append(std::uint32_t row)
+	{
+		file.seekp(write_offset);
+		file.write(reinterpret_cast<const char *>(&row), sizeof(row));
+		write_offset = file.tellp();
+		pending++;
+	}
+
+	std::uint32_t next()
+	{
+		std::uint32_t row;
+		file.seekg(read_offset);
+		if (!file.read(reinterpret_cast<char *>(&row), sizeof(row)))
+			throw std::runtime_error("Couldn't read an item back from the DataMonitor spill file.");
+		read_offset = file.tellg();
+		pending--;
+		if (pending == 0)
+			read_offset = write_offset = 0;
+		return row;
+	}
+
+	long pending_count() const
+	{
+		return pending;
+	}
+
+private:
+	std::fstream file;
+	std::streamoff write_offset = 0;
+	std::streamoff read_offset = 0;
+	long pending = 0;
+};
+
+// A person taken from a DataMonitor: the row it has in the table and a view of it.
+struct QueuedPerson
+{
+	std::uint32_t row;
+	Person person;
+};
+
+// Bounded FIFO queue of persons between the producers and the workers. Persons
+// are queued as rows of the table, which has to outlive the queue, and handed
+// out as views of it.
+class DataMonitor
+{
+public:
+	DataMonitor(const PersonTable &table, int size, bool &data_exists, PipelineStats *stats = nullptr, OverflowPolicy overflow_policy = OverflowPolicy::Block,
+				WaitMode wait_mode = WaitMode::Block, std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+		: table(table), rows(resource), wait_strategy(wait_mode)
+	{
+		if (size < 1)
+		{
+			throw std::runtime_error("Incorrect initial given size to a DataMonitor. Initial size has to be at least 1.");
+		}
+
+		if (!data_exists)
+			throw std::runtime_error("DataMonitor cannot be created if there is no data to begin with.");
+
+		rows.resize(size);
+		this->size = size;
+		this->size_used = 0;
+		this->head = 0;
+		this->data_exists = data_exists;
+		this->cancelled = false;
+		this->stats = stats;
+		this->overflow_policy = overflow_policy;
+	}
+	void notify_workers_no_data()
+	{
+		{
+			std::lock_guard<std::mutex> lock(monitor_mtx);
+			data_exists = false;
+		}
+		wait_strategy.notify(cv);
+	}
+	// Wakes everyone up for good: addItem stops adding, removeItem returns
+	// nothing at once and the queued items stay unprocessed.
+	void cancel()
+	{
+		{
+			std::lock_guard<std::mutex> lock(monitor_mtx);
+			cancelled = true;
+		}
+		wait_strategy.notify(cv);
+	}
+
+	void addItem(std::uint32_t row)
+	{
+		{
+			double waited_ms = 0;
+			std::unique_lock<std::mutex> lock(monitor_mtx, std::defer_lock);
+			{
+				ScopedTimer timer(waited_ms);
+				wait_strategy.lock(lock);
+				if (overflow_policy == OverflowPolicy::Block)
+					wait_strategy.wait(lock, cv, [this]
+									   { return size_used < size || cancelled; }); // wait until there is space in the data_monitor
+			}
+			if (stats != nullptr)
+				stats->current().add_wait_ms += waited_ms;
+			if (cancelled)
+				return;
+
+			if (overflow_policy == OverflowPolicy::Spill && (size_used == size || spill_pending() > 0))
+			{
+				// once something is spilled, later items follow it to the file to keep the FIFO order
+				if (!spill)
+					spill = std::make_unique<SpillSegment>();
+				spill->append(row);
+				counters.spilled++;
+			}
+			else if (size_used == size && overflow_policy == OverflowPolicy::DropNewest)
+			{
+				counters.dropped_newest++;
+				return;
+			}
+			else if (size_used == size)
+			{
+				// DropOldest: overwrite the slot of the oldest item
+				rows[head] = row;
+				head = (head + 1) % size;
+				counters.dropped_oldest++;
+			}
+			else
+			{
+				rows[(head + size_used) % size] = row;
+				size_used++;
+			}
+			if (stats != nullptr)
+				stats->record_queue_depth(size_used + spill_pending());
+		}
+		wait_strategy.notify(cv); // notify that there is an item added to the data_monitor
+	}
+	// The next person, or nothing once the data has run out or the queue is cancelled.
+	std::optional<QueuedPerson> removeItem()
+	{
+		std::uint32_t row;
+		{
+			double waited_ms = 0;
+			std::unique_lock<std::mutex> lock(monitor_mtx, std::defer_lock);
+			{
+				ScopedTimer timer(waited_ms);
+				wait_strategy.lock(lock);
+				wait_strategy.wait(lock, cv, [this]
+								   { return size_used > 0 || spill_pending() > 0 || !data_exists || cancelled; });
+			}
+			if (stats != nullptr)
+				stats->current().remove_wait_ms += waited_ms;
+			if (cancelled || (!data_exists && size_used == 0 && spill_pending() == 0))
+				return std::nullopt;
+
+			// copy the item while still holding the lock, otherwise the producer can overwrite the slot
+			if (size_used > 0)
+			{
+				row = rows[head];
+				head = (head + 1) % size;
+				size_used--;
+			}
+			else
+			{
+				row = spill->next();
+				counters.unspilled++;
+			}
+			if (stats != nullptr)
+				stats->record_queue_depth(size_used + spill_pending());
+		}
+		wait_strategy.notify(cv); // notify that there is an item removed from the data_monitor
+		return QueuedPerson{row, table[row]};
+	}
+	bool is_full()
+	{
+		std::unique_lock<std::mutex> lock(monitor_mtx);
+		return size == size_used;
+	}
+	bool is_empty()
+	{
+		std::unique_lock<std::mutex> lock(monitor_mtx);
+		return size_used == 0 && spill_pending() == 0;
+	}
+
+	int get_size()
+	{
+		std::unique_lock<std::mutex> lock(monitor_mtx);
+		return size;
+	}
+
+	OverflowCounters get_overflow_counters()
+	{
+		std::unique_lock<std::mutex> lock(monitor_mtx);
+		return counters;
+	}
+
+	WaitStats get_wait_stats() const
+	{
+		return wait_strategy.get_stats();
+	}
+
+private:
+	long spill_pending() const
+	{
+		return spill ? spill->pending_count() : 0;
+	}
+
+	// The fields are grouped by who writes them, one group per cache line: the
+	// configuration is only read after construction, the queue state is written
+	// under the lock (so it shares the lock's line), the condition variable is
+	// written by the waiters and WaitStrategy aligns its own atomics.
+	const PersonTable &table;
+	std::pmr::vector<std::uint32_t> rows; // ring buffer, the oldest item is at rows[head]; slots are reused in place
+	int size;
+	PipelineStats *stats;
+	OverflowPolicy overflow_policy;
+
+	alignas(cache_line_size) std::mutex monitor_mtx;
+	int size_used;
+	int head;
+	bool data_exists;
+	bool cancelled;
+	OverflowCounters counters;
+	std::unique_ptr<SpillSegment> spill; // created on the first overflow
+
+	alignas(cache_line_size) std::condition_variable cv;
+	WaitStrategy wait_strategy;
+};
+
+class SortedResultMonitor
+{
+public:
+	// top_k > 0 keeps only the K youngest results, in a bounded heap, instead of all of them;
+	// sort_method other than Insertion appends results as they come and sorts them once in getItems
+	SortedResultMonitor(int size, PipelineStats *stats = nullptr, WaitMode wait_mode = WaitMode::Block,
+						std::pmr::memory_resource *resource = std::pmr::get_default_resource(), int top_k = 0,
+						SortMethod sort_method = SortMethod::Insertion)
+		: persons(resource), top(std::max(top_k, 0), Younger(), resource), wait_strategy(wait_mode)
+	{
+		if (size < 1)
+		{
+			throw std::runtime_error("Incorrect initial given size to a SortedResultMonitor. Initial size has to be at least 1.");
+		}
+
+		if (top_k <= 0)
+			persons.resize(size);
+		this->size = size;
+		this->top_k = top_k;
+		this->sort_method = sort_method;
+		this->size_used = 0;
+		this->stats = stats;
+	}
+	int addItemSorted(PersonWithChangedData item)
+	{
+		{
+			double waited_ms = 0;
+			std::unique_lock<std::mutex> lock(monitor_mtx, std::defer_lock);
+			{
+				ScopedTimer timer(waited_ms);
+				wait_strategy.lock(lock);
+			}
+			if (stats != nullptr)
+				stats->current().sorted_wait_ms += waited_ms;
+			if (top_k > 0)
+				top.push(item); // O(log K), drops the item if K younger ones are kept already
+			else if (!insert_sorted(item))
+				return -1; // SortedResultMonitor is full
+		}
+		wait_strategy.notify(cv);
+		return 0;
+	}
+	std::vector<PersonWithChangedData> getItems()
+	{
+		std::unique_lock<std::mutex> lock(monitor_mtx);
+		if (top_k > 0)
+			return top.sorted();
+		std::vector<PersonWithChangedData> items;
+		for (int i = 0; i < size_used; i++)
+		{
+			items.push_back(persons[i]);
+		}
+		sort_results(items, sort_method);
+		return items;
+	}
+
+	WaitStats get_wait_stats() const
+	{
+		return wait_strategy.get_stats();
+	}
+
+private:
+	// Inserts the item in age order, false if there is no space left.
+	bool insert_sorted(const PersonWithChangedData &item)
+	{
+		if (size_used == size)
+			return false;
+
+		if (sort_method != SortMethod::Insertion)
+		{
+			persons[size_used++] = item; // sorted later, in getItems
+			return true;
+		}
+
+		// find the position to place the item, and if needed push other elements forwards
+		if (size_used == 0)
+		{
+			persons[0] = item;
+		}
+		else
+		{
+			int index_to_insert = -1;
+			for (int i = 0; i < size_used; i++)
+				if (item.age < persons[i].age)
+				{
+					index_to_insert = i;
+					break;
+				}
+
+			if (index_to_insert == -1)
+				persons[size_used] = item;
+			else
+			{
+				// shift the existing persons to the right
+				for (int i = size_used; i > index_to_insert; i--)
+					persons[i] = persons[i - 1];
+
+				// insert the new person
+				persons[index_to_insert] = item;
+			}
+		}
+		size_used++;
+		return true;
+	}
+
+	// same grouping as in DataMonitor
+	std::pmr::vector<PersonWithChangedData> persons;
+	int size;
+	int top_k;
+	SortMethod sort_method;
+	PipelineStats *stats;
+
+	alignas(cache_line_size) std::mutex monitor_mtx;
+	int size_used;
+	bool data_exists;
+	TopK<PersonWithChangedData, Younger> top; // used instead of persons when top_k > 0
+
+	alignas(cache_line_size) std::condition_variable cv;
+	WaitStrategy wait_strategy;
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "inline_string.hpp"
+
+// A row of a PersonTable. The name points into the table's name arena, so a
+// Person is only valid as long as the table it was read from; it is cheap to
+// copy, but only its row index can be written out and read back.
+struct Person
+{
+	int id;
+	double age;
+	std::string_view name;
+};
+static_assert(std::is_trivially_copyable<Person>::value, "Person is copied around as raw bytes");
+
+// modify_person_data always generates names of this length
+constexpr std::size_t MODIFIED_NAME_LENGTH = 30;
+
+// The id modify_person_data generates, in closed form. The kernel sums
+// id * i + i * j over i < 1000000 and j < 100 in 32-bit int arithmetic, which
+// wraps, so the sum is (id * T + 4950 * T) mod 2^32 with T = sum of i.
+inline int modified_id(int person_id)
+{
+	constexpr std::uint32_t triangle = (std::uint32_t)499999500000ULL; // T mod 2^32
+	const std::uint32_t sum = (std::uint32_t)person_id * triangle + 4950u * triangle;
+	return (std::int32_t)sum / 100000000;
+}
+
+struct PersonWithChangedData
+{
+	Person originalData;
+	int id;
+	double age;
+	InlineString<MODIFIED_NAME_LENGTH> name; // no heap allocation per result
+};
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+#include "person.hpp"
+#include "person_table.hpp"
+
+// Person data can be stored in three formats, picked by the file extension:
+//   .json  - a JSON array of {"age", "id", "name"} objects (the original format)
+//   .jsonl - JSON Lines, one such object per line
+//   .bin   - the binary format below
+//
+// Binary format (native little-endian):
+//   header: char magic[4] = "PRSN", uint32 version = 1, uint64 record count
+//   record: int32 id, double age, uint16 name length, name bytes (no terminator)
+
+constexpr char PERSONS_BINARY_MAGIC[4] = {'P', 'R', 'S', 'N'};
+constexpr std::uint32_t PERSONS_BINARY_VERSION = 1;
+// a record with an empty name
+constexpr std::uint64_t PERSON_RECORD_MIN_BYTES = sizeof(std::int32_t) + sizeof(double) + sizeof(std::uint16_t);
+
+inline bool ends_with(const std::string &text, const std::string &suffix)
+{
+	return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+inline void write_persons_binary_header(std::ostream &o, std::uint64_t count)
+{
+	o.write(PERSONS_BINARY_MAGIC, sizeof(PERSONS_BINARY_MAGIC));
+	o.write(reinterpret_cast<const char *>(&PERSONS_BINARY_VERSION), sizeof(PERSONS_BINARY_VERSION));
+	o.write(reinterpret_cast<const char *>(&count), sizeof(count));
+}
+
+// Returns the record count, or -1 if the stream does not start with a valid header.
+inline std::int64_t read_persons_binary_header(std::istream &in)
+{
+	char magic[4];
+	std::uint32_t version;
+	std::uint64_t count;
+	if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, PERSONS_BINARY_MAGIC, sizeof(magic)) != 0)
+		return -1;
+	if (!in.read(reinterpret_cast<char *>(&version), sizeof(version)) || version != PERSONS_BINARY_VERSION)
+		return -1;
+	if (!in.read(reinterpret_cast<char *>(&count), sizeof(count)))
+		return -1;
+	return count;
+}
+
+// Whether the rest of the stream is long enough for count records, so a
+// corrupt header count is caught before anything is allocated for it.
+inline bool persons_binary_count_fits(std::istream &in, std::uint64_t count)
+{
+	const std::streampos records_start = in.tellg();
+	if (records_start < 0 || !in.seekg(0, std::ios::end))
+		return false;
+	const std::uint64_t record_bytes = in.tellg() - records_start;
+	in.seekg(records_start);
+	return in && count <= record_bytes / PERSON_RECORD_MIN_BYTES;
+}
+
+inline void write_person_record(std::ostream &o, const Person &person)
+{
+	const std::int32_t id = person.id;
+	const std::uint16_t name_length = person.name.size() > UINT16_MAX ? UINT16_MAX : person.name.size();
+	o.write(reinterpret_cast<const char *>(&id), sizeof(id));
+	o.write(reinterpret_cast<const char *>(&person.age), sizeof(person.age));
+	o.write(reinterpret_cast<const char *>(&name_length), sizeof(name_length));
+	o.write(person.name.data(), name_length);
+}
+
+// Appends the next record of the stream to the table. The name is read
+// through name_buffer, which the caller keeps for all the records.
+inline bool read_person_record(std::istream &in, PersonTable &table, std::string &name_buffer)
+{
+	std::int32_t id;
+	double age;
+	std::uint16_t name_length;
+	if (!in.read(reinterpret_cast<char *>(&id), sizeof(id)))
+		return false;
+	if (!in.read(reinterpret_cast<char *>(&age), sizeof(age)))
+		return false;
+	if (!in.read(reinterpret_cast<char *>(&name_length), sizeof(name_length)))
+		return false;
+	name_buffer.resize(name_length);
+	if (!in.read(name_buffer.data(), name_length))
+		return false;
+	table.push_back(id, age, name_buffer);
+	return true;
+}
+
+inline void append_person_from_json(PersonTable &table, const nlohmann::json &element)
+{
+	table.push_back(element.at("id").get<int>(), element.at("age").get<double>(), element.at("name").get_ref<const std::string &>());
+}
+
+inline PersonTable load_json_file(const std::string &file_name)
+{
+	std::ifstream f(file_name);
+	if (!f.is_open())
+	{
+		std::cerr << "Failed to open given '" << file_name << "' file." << std::endl;
+		return PersonTable();
+	}
+	nlohmann::json data = nlohmann::json::parse(f);
+	PersonTable table;
+	table.reserve(data.size());
+	for (auto &element : data)
+		append_person_from_json(table, element);
+	f.close();
+
+	return table;
+}
+
+inline PersonTable load_json_lines_file(const std::string &file_name)
+{
+	std::ifstream f(file_name);
+	if (!f.is_open())
+	{
+		std::cerr << "Failed to open given '" << file_name << "' file." << std::endl;
+		return PersonTable();
+	}
+	PersonTable table;
+	std::string line;
+	while (std::getline(f, line))
+	{
+		if (line.empty())
+			continue;
+		append_person_from_json(table, nlohmann::json::parse(line));
+	}
+	return table;
+}
+
+inline PersonTable load_binary_file(const std::string &file_name)
+{
+	std::ifstream f(file_name, std::ios::binary);
+	if (!f.is_open())
+	{
+		std::cerr << "Failed to open given '" << file_name << "' file." << std::endl;
+		return PersonTable();
+	}
+	const std::int64_t count = read_persons_binary_header(f);
+	if (count < 0)
+	{
+		std::cerr << "'" << file_name << "' is not a persons binary file." << std::endl;
+		return PersonTable();
+	}
+	if (!persons_binary_count_fits(f, count))
+	{
+		std::cerr << "'" << file_name << "' is too short for the " << count << " records its header gives." << std::endl;
+		return PersonTable();
+	}
+	PersonTable table;
+	table.reserve(count);
+	std::string name_buffer;
+	for (std::int64_t i = 0; i < count; i++)
+	{
+		if (!read_person_record(f, table, name_buffer))
+		{
+			std::cerr << "'" << file_name << "' is truncated." << std::endl;
+			return PersonTable();
+		}
+	}
+	return table;
+}
+
+// Loads persons from a .json, .jsonl or .bin file.
+inline PersonTable load_persons_file(const std::string &file_name)
+{
+	if (ends_with(file_name, ".jsonl"))
+		return load_json_lines_file(file_name);
+	if (ends_with(file_name, ".bin"))
+		return load_binary_file(file_name);
+	return load_json_file(file_name);
+}
+
+// Reads a .json, .jsonl or .bin file like load_persons_file, but hands the
+// persons to on_chunk(PersonTable &&) in tables of chunk_rows (the last one
+// may be smaller) as soon as each is read, so they can be processed while the
+// rest of the file is parsed. A .json array is parsed with a callback that
+// drops every element once it is converted, so the document is never held
+// whole. Returns false if the file can't be read; the chunks handed out
+// before a truncated .bin record stay valid.
+template <typename OnChunk>
+bool read_persons_in_chunks(const std::string &file_name, std::size_t chunk_rows, OnChunk on_chunk)
+{
+	const bool binary = ends_with(file_name, ".bin");
+	std::ifstream f(file_name, binary ? std::ios::in | std::ios::binary : std::ios::in);
+	if (!f.is_open())
+	{
+		std::cerr << "Failed to open given '" << file_name << "' file." << std::endl;
+		return false;
+	}
+
+	PersonTable chunk;
+	auto flush = [&](bool last)
+	{
+		if (chunk.size() == chunk_rows || (last && !chunk.empty()))
+		{
+			on_chunk(std::move(chunk));
+			chunk = PersonTable();
+		}
+	};
+
+	if (binary)
+	{
+		const std::int64_t count = read_persons_binary_header(f);
+		if (count < 0)
+		{
+			std::cerr << "'" << file_name << "' is not a persons binary file." << std::endl;
+			return false;
+		}
+		if (!persons_binary_count_fits(f, count))
+		{
+			std::cerr << "'" << file_name << "' is too short for the " << count << " records its header gives." << std::endl;
+			return false;
+		}
+		std::string name_buffer;
+		for (std::int64_t i = 0; i < count; i++)
+		{
+			if (!read_person_record(f, chunk, name_buffer))
+			{
+				std::cerr << "'" << file_name << "' is truncated." << std::endl;
+				return false;
+			}
+			flush(false);
+		}
+	}
+	else if (ends_with(file_name, ".jsonl"))
+	{
+		std::string line;
+		while (std::getline(f, line))
+		{
+			if (line.empty())
+				continue;
+			append_person_from_json(chunk, nlohmann::json::parse(line));
+			flush(false);
+		}
+	}
+	else
+	{
+		// every element is dropped once converted, which leaves an empty array
+		const nlohmann::json rest = nlohmann::json::parse(f, [&](int depth, nlohmann::json::parse_event_t event, nlohmann::json &parsed)
+															  {
+			if (depth != 1 || event != nlohmann::json::parse_event_t::object_end)
+				return true;
+			append_person_from_json(chunk, parsed);
+			flush(false);
+			return false; });
+	}
+	flush(true);
+	return true;
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "person.hpp"
+
+// A read-only view of `size` contiguous elements of one PersonTable column.
+template <typename T>
+class ColumnSpan
+{
+public:
+	ColumnSpan(const T *data, std::size_t size) : elements(data), length(size)
+	{
+	}
+
+	const T *begin() const
+	{
+		return elements;
+	}
+	const T *end() const
+	{
+		return elements + length;
+	}
+	const T *data() const
+	{
+		return elements;
+	}
+	std::size_t size() const
+	{
+		return length;
+	}
+	const T &operator[](std::size_t i) const
+	{
+		return elements[i];
+	}
+
+	ColumnSpan subspan(std::size_t offset, std::size_t count) const
+	{
+		return ColumnSpan(elements + offset, count);
+	}
+
+private:
+	const T *elements;
+	std::size_t length;
+};
+
+// Persons stored column by column: ids and ages in their own contiguous arrays,
+// so kernels that only need numbers never touch the names, and all names in one
+// character arena indexed by an offsets column (row i's name is
+// names[name_offsets[i], name_offsets[i + 1])).
+//
+// Rows are read as Person views. Like vector iterators, views are invalidated by
+// adding rows, so a table is filled first and read afterwards.
+class PersonTable
+{
+public:
+	class const_iterator
+	{
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type = Person;
+		using difference_type = std::ptrdiff_t;
+		using pointer = void;
+		using reference = Person;
+
+		const_iterator(const PersonTable *table, std::size_t row) : table(table), row(row)
+		{
+		}
+
+		Person operator*() const
+		{
+			return (*table)[row];
+		}
+		const_iterator &operator++()
+		{
+			row++;
+			return *this;
+		}
+		const_iterator operator++(int)
+		{
+			const_iterator old = *this;
+			row++;
+			return old;
+		}
+		bool operator==(const const_iterator &other) const
+		{
+			return row == other.row;
+		}
+		bool operator!=(const const_iterator &other) const
+		{
+			return row != other.row;
+		}
+
+	private:
+		const PersonTable *table;
+		std::size_t row;
+	};
+
+	PersonTable()
+	{
+		name_offsets.push_back(0);
+	}
+
+	void reserve(std::size_t rows, std::size_t name_bytes = 0)
+	{
+		ids.reserve(rows);
+		ages.reserve(rows);
+		name_offsets.reserve(rows + 1);
+		names.reserve(name_bytes);
+	}
+
+	void push_back(int id, double age, std::string_view name)
+	{
+		if (names.size() + name.size() > UINT32_MAX)
+			throw std::length_error("PersonTable name arena is limited to 4 GiB.");
+		ids.push_back(id);
+		ages.push_back(age);
+		// a name viewed from this very table (e.g. a duplicated row) has to be appended by offset,
+		// the arena may move while it grows
+		if (!name.empty() && name.data() >= names.data() && name.data() < names.data() + names.size())
+			names.append(names, name.data() - names.data(), name.size());
+		else
+			names.append(name);
+		name_offsets.push_back(names.size());
+	}
+
+	void push_back(const Person &person)
+	{
+		push_back(person.id, person.age, person.name);
+	}
+
+	void clear()
+	{
+		ids.clear();
+		ages.clear();
+		names.clear();
+		name_offsets.assign(1, 0);
+	}
+
+	std::size_t size() const
+	{
+		return ids.size();
+	}
+	bool empty() const
+	{
+		return ids.empty();
+	}
+
+	Person operator[](std::size_t row) const
+	{
+		return Person{ids[row], ages[row], name(row)};
+	}
+
+	std::string_view name(std::size_t row) const
+	{
+		return std::string_view(names.data() + name_offsets[row], name_offsets[row + 1] - name_offsets[row]);
+	}
+
+	ColumnSpan<int> id_column() const
+	{
+		return ColumnSpan<int>(ids.data(), ids.size());
+	}
+	ColumnSpan<double> age_column() const
+	{
+		return ColumnSpan<double>(ages.data(), ages.size());
+	}
+
+	// total size of the names, in bytes
+	std::size_t name_bytes() const
+	{
+		return names.size();
+	}
+
+	const_iterator begin() const
+	{
+		return const_iterator(this, 0);
+	}
+	const_iterator end() const
+	{
+		return const_iterator(this, size());
+	}
+
+private:
+	std::vector<int> ids;
+	std::vector<double> ages;
+	std::vector<std::uint32_t> name_offsets; // one more than there are rows
+	std::string names;
+};
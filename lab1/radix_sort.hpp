@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "person.hpp"
+#include "top_k.hpp"
+
+// How results are put in age order.
+enum class SortMethod
+{
+	Insertion, // insert every result in place as it arrives (SortedResultMonitor's original way)
+	Radix,	   // collect unsorted, then one parallel LSD radix sort
+	Std		   // collect unsorted, then std::sort
+};
+
+inline bool parse_sort_method(const std::string &name, SortMethod &method)
+{
+	if (name == "insert")
+		method = SortMethod::Insertion;
+	else if (name == "radix")
+		method = SortMethod::Radix;
+	else if (name == "std")
+		method = SortMethod::Std;
+	else
+		return false;
+	return true;
+}
+
+// Maps a double to an unsigned integer with the same order: negative numbers
+// have all their bits flipped, the others just the sign bit. -0.0 is made
+// +0.0 first, since Younger sees them as equal and orders them by id.
+inline std::uint64_t age_sort_key(double age)
+{
+	if (age == 0)
+		age = 0;
+	std::uint64_t bits;
+	std::memcpy(&bits, &age, sizeof(bits));
+	return (bits & 0x8000000000000000ULL) ? ~bits : bits ^ 0x8000000000000000ULL;
+}
+
+inline std::uint32_t id_sort_key(int id)
+{
+	return (std::uint32_t)id ^ 0x80000000U;
+}
+
+namespace radix_detail
+{
+	struct Entry
+	{
+		std::uint64_t age_key;
+		std::uint32_t id_key;
+		std::uint32_t index; // position of the record in the input
+	};
+
+	// 11-bit digits keep a thread's histogram (16 KiB) in L1 while needing 3 + 6 passes instead of 4 + 8
+	constexpr int DIGIT_BITS = 11;
+	constexpr int BUCKETS = 1 << DIGIT_BITS;
+	constexpr int ID_PASSES = (32 + DIGIT_BITS - 1) / DIGIT_BITS;
+	constexpr int AGE_PASSES = (64 + DIGIT_BITS - 1) / DIGIT_BITS;
+	constexpr int PASSES = ID_PASSES + AGE_PASSES;
+
+	// least significant first: the digits of the id key, then those of the age key
+	inline unsigned digit(const Entry &e, int pass)
+	{
+		if (pass < ID_PASSES)
+			return (e.id_key >> (pass * DIGIT_BITS)) & (BUCKETS - 1);
+		return (e.age_key >> ((pass - ID_PASSES) * DIGIT_BITS)) & (BUCKETS - 1);
+	}
+
+	template <typename Body>
+	void run_chunks(int threads, std::size_t count, Body body)
+	{
+		if (threads == 1)
+		{
+			body(0, 0, count);
+			return;
+		}
+		std::vector<std::thread> workers;
+		for (int t = 0; t < threads; t++)
+			workers.emplace_back(body, t, count * t / threads, count * (t + 1) / threads);
+		for (auto &worker : workers)
+			worker.join();
+	}
+}
+
+// Sorts results by age, equal ages by id, with a parallel LSD radix sort over
+// the 96-bit (age, id) key. Every pass is a stable counting sort: the threads
+// count digits in their own chunk, a prefix sum over (digit, thread) gives
+// every chunk its output positions, and the threads scatter in parallel. Passes
+// in which all keys share the digit (high id bytes, exponent bits) are skipped.
+// Only 16-byte key entries move during the passes; the records are gathered
+// once at the end.
+inline void radix_sort_results(std::vector<PersonWithChangedData> &results, int threads = std::thread::hardware_concurrency())
+{
+	using namespace radix_detail;
+	const std::size_t count = results.size();
+	if (count < 2)
+		return;
+	// small inputs aren't worth the thread start-up
+	threads = std::max(1, std::min<int>(threads, count / (1 << 14)));
+
+	std::vector<Entry> entries(count), buffer(count);
+	run_chunks(threads, count, [&](int, std::size_t begin, std::size_t end)
+			   {
+		for (std::size_t i = begin; i < end; i++)
+			entries[i] = {age_sort_key(results[i].age), id_sort_key(results[i].id), (std::uint32_t)i}; });
+
+	std::vector<std::size_t> histograms(threads * BUCKETS);
+	for (int pass = 0; pass < PASSES; pass++)
+	{
+		std::fill(histograms.begin(), histograms.end(), 0);
+		run_chunks(threads, count, [&](int t, std::size_t begin, std::size_t end)
+				   {
+			std::size_t *histogram = &histograms[t * BUCKETS];
+			for (std::size_t i = begin; i < end; i++)
+				histogram[digit(entries[i], pass)]++; });
+
+		// a digit shared by every key doesn't reorder anything
+		bool trivial = false;
+		for (int d = 0; d < BUCKETS && !trivial; d++)
+		{
+			std::size_t total = 0;
+			for (int t = 0; t < threads; t++)
+				total += histograms[t * BUCKETS + d];
+			trivial = total == count;
+		}
+		if (trivial)
+			continue;
+
+		// turn the counts into output offsets, digit major, thread minor, which keeps the sort stable
+		std::size_t offset = 0;
+		for (int d = 0; d < BUCKETS; d++)
+			for (int t = 0; t < threads; t++)
+			{
+				const std::size_t n = histograms[t * BUCKETS + d];
+				histograms[t * BUCKETS + d] = offset;
+				offset += n;
+			}
+
+		run_chunks(threads, count, [&](int t, std::size_t begin, std::size_t end)
+				   {
+			std::size_t *next = &histograms[t * BUCKETS];
+			for (std::size_t i = begin; i < end; i++)
+				buffer[next[digit(entries[i], pass)]++] = entries[i]; });
+		entries.swap(buffer);
+	}
+
+	// the gather reads records in random order, so fetch a few ahead
+	constexpr std::size_t PREFETCH_DISTANCE = 8;
+	auto prefetch = [&](std::size_t i)
+	{
+		if (i + PREFETCH_DISTANCE < count)
+			__builtin_prefetch(&results[entries[i + PREFETCH_DISTANCE].index]);
+	};
+	std::vector<PersonWithChangedData> sorted(count);
+	run_chunks(threads, count, [&](int, std::size_t begin, std::size_t end)
+			   {
+		for (std::size_t i = begin; i < end; i++)
+		{
+			prefetch(i);
+			sorted[i] = results[entries[i].index];
+		} });
+	results.swap(sorted);
+}
+
+// Puts collected results in age order. Radix and std give the same order
+// (equal ages by id); insertion order results are already sorted.
+inline void sort_results(std::vector<PersonWithChangedData> &results, SortMethod method, int threads = std::thread::hardware_concurrency())
+{
+	if (method == SortMethod::Radix)
+		radix_sort_results(results, threads);
+	else if (method == SortMethod::Std)
+		std::sort(results.begin(), results.end(), Younger());
+}
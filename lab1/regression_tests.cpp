@@ -0,0 +1,458 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "checkpoint.hpp"
+#include "monitors.hpp"
+#include "person_formats.hpp"
+#include "person_table.hpp"
+#include "radix_sort.hpp"
+#include "top_k.hpp"
+
+// Regression checks for the parts of the pipelines whose mistakes don't show
+// in the output of a run on the sample data. Every check prints PASS or FAIL
+// with its name; the program exits with 1 if any of them failed.
+
+int failures = 0;
+
+void check(bool passed, const std::string &name)
+{
+	std::cout << (passed ? "PASS " : "FAIL ") << name << std::endl;
+	if (!passed)
+		failures++;
+}
+
+// A table whose row r has id r and name "p<r>", so a view shows which row it is.
+PersonTable numbered_table(int rows)
+{
+	PersonTable table;
+	for (int r = 0; r < rows; r++)
+		table.push_back(r, r, "p" + std::to_string(r));
+	return table;
+}
+
+// Ends the data and takes out everything left, in order.
+std::vector<std::uint32_t> drain(DataMonitor &monitor)
+{
+	monitor.notify_workers_no_data();
+	std::vector<std::uint32_t> rows;
+	while (std::optional<QueuedPerson> item = monitor.removeItem())
+		rows.push_back(item->row);
+	return rows;
+}
+
+std::vector<std::uint32_t> row_range(std::uint32_t begin, std::uint32_t end)
+{
+	std::vector<std::uint32_t> rows;
+	for (std::uint32_t r = begin; r < end; r++)
+		rows.push_back(r);
+	return rows;
+}
+
+// A result named after its id, so a result that got separated from its
+// fields shows.
+PersonWithChangedData make_result(int id, double age)
+{
+	PersonWithChangedData result;
+	result.originalData = {id, age, ""};
+	result.id = id;
+	result.age = age;
+	result.name = std::to_string(id);
+	return result;
+}
+
+// count results with ages of one decimal, as the kernel makes them, so that
+// many of them tie
+std::vector<PersonWithChangedData> random_results(int count, unsigned seed)
+{
+	std::mt19937 gen(seed);
+	std::uniform_int_distribution<int> age(-500, 500);
+	std::uniform_int_distribution<int> id(-1000000, -1);
+	std::vector<PersonWithChangedData> results;
+	for (int i = 0; i < count; i++)
+		results.push_back(make_result(id(gen), age(gen) / 10.0));
+	return results;
+}
+
+// Same ages and ids in the same order, and every name still matches its id.
+bool same_order(const std::vector<PersonWithChangedData> &a, const std::vector<PersonWithChangedData> &b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (std::size_t i = 0; i < a.size(); i++)
+		if (a[i].age != b[i].age || a[i].id != b[i].id || std::string_view(a[i].name) != std::to_string(a[i].id))
+			return false;
+	return true;
+}
+
+std::vector<PersonWithChangedData> std_sorted(std::vector<PersonWithChangedData> results)
+{
+	std::sort(results.begin(), results.end(), Younger());
+	return results;
+}
+
+void test_overflow_policies()
+{
+	const PersonTable table = numbered_table(10);
+	bool data_exists = true;
+
+	{
+		DataMonitor monitor(table, 2, data_exists, nullptr, OverflowPolicy::Block);
+		monitor.addItem(0);
+		monitor.addItem(1);
+		std::atomic<bool> added{false};
+		std::thread producer([&]
+							 {
+			monitor.addItem(2);
+			added = true; });
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		check(!added, "block: addItem waits while the queue is full");
+		std::optional<QueuedPerson> first = monitor.removeItem();
+		producer.join();
+		check(first && first->row == 0 && added, "block: removing an item lets the producer in");
+		check(drain(monitor) == std::vector<std::uint32_t>{1, 2}, "block: the items come out in FIFO order");
+	}
+
+	{
+		DataMonitor monitor(table, 3, data_exists, nullptr, OverflowPolicy::DropOldest);
+		for (std::uint32_t r = 0; r < 6; r++)
+			monitor.addItem(r);
+		check(monitor.get_overflow_counters().dropped_oldest == 3, "drop-oldest: counts the overwritten items");
+		check(drain(monitor) == row_range(3, 6), "drop-oldest: keeps the newest items, in order");
+	}
+
+	{
+		DataMonitor monitor(table, 3, data_exists, nullptr, OverflowPolicy::DropNewest);
+		for (std::uint32_t r = 0; r < 6; r++)
+			monitor.addItem(r);
+		check(monitor.get_overflow_counters().dropped_newest == 3, "drop-newest: counts the discarded items");
+		check(drain(monitor) == row_range(0, 3), "drop-newest: keeps the oldest items, in order");
+	}
+
+	{
+		DataMonitor monitor(table, 2, data_exists, nullptr, OverflowPolicy::Spill);
+		for (std::uint32_t r = 0; r < 4; r++)
+			monitor.addItem(r);
+		std::optional<QueuedPerson> first = monitor.removeItem();
+		// the queue has room again, but 2 and 3 are still in the file
+		for (std::uint32_t r = 4; r < 10; r++)
+			monitor.addItem(r);
+		std::vector<std::uint32_t> rows = drain(monitor);
+		rows.insert(rows.begin(), first->row);
+		const OverflowCounters counters = monitor.get_overflow_counters();
+		check(rows == row_range(0, 10), "spill: nothing is lost and the FIFO order holds across the file");
+		check(counters.spilled == 8 && counters.unspilled == 8, "spill: counts the items written to and read from the file");
+	}
+
+	{
+		DataMonitor monitor(table, 1, data_exists, nullptr, OverflowPolicy::Spill);
+		for (std::uint32_t r = 0; r < 10; r++)
+			monitor.addItem(r);
+		bool views_match = true;
+		monitor.notify_workers_no_data();
+		while (std::optional<QueuedPerson> item = monitor.removeItem())
+			views_match = views_match && item->person.id == (int)item->row && item->person.name == "p" + std::to_string(item->row);
+		check(views_match, "spill: spilled items come back as views of their rows");
+	}
+
+	{
+		DataMonitor monitor(table, 2, data_exists);
+		monitor.addItem(0);
+		monitor.cancel();
+		check(!monitor.removeItem(), "cancel: removeItem returns nothing with items still queued");
+	}
+}
+
+void test_top_k()
+{
+	const std::vector<PersonWithChangedData> results = random_results(5000, 1);
+	const std::vector<PersonWithChangedData> all_sorted = std_sorted(results);
+	auto first = [&](std::size_t k)
+	{ return std::vector<PersonWithChangedData>(all_sorted.begin(), all_sorted.begin() + std::min(k, all_sorted.size())); };
+
+	TopK<PersonWithChangedData, Younger> top(10);
+	for (const auto &result : results)
+		top.push(result);
+	check(same_order(top.sorted(), first(10)), "top-k: keeps the K youngest, equal ages by id");
+
+	TopK<PersonWithChangedData, Younger> all(1000000);
+	for (const auto &result : results)
+		all.push(result);
+	check(same_order(all.sorted(), all_sorted), "top-k: a K larger than the input keeps everything");
+
+	TopK<PersonWithChangedData, Younger> none(0);
+	check(!none.push(results[0]) && none.size() == 0, "top-k: K = 0 keeps nothing");
+
+	// every thread keeps a heap of its own and they are merged at the end
+	std::vector<TopK<PersonWithChangedData, Younger>> parts(4, TopK<PersonWithChangedData, Younger>(25));
+	for (std::size_t i = 0; i < results.size(); i++)
+		parts[i % parts.size()].push(results[i]);
+	TopK<PersonWithChangedData, Younger> merged(25);
+	for (const auto &part : parts)
+		merged.merge(part);
+	check(same_order(merged.sorted(), first(25)), "top-k: merged heaps hold the K youngest of all of them");
+
+	SortedResultMonitor monitor(results.size(), nullptr, WaitMode::Block, std::pmr::get_default_resource(), 7);
+	for (const auto &result : results)
+		monitor.addItemSorted(result);
+	check(same_order(monitor.getItems(), first(7)), "top-k: SortedResultMonitor with top_k returns the K youngest");
+}
+
+void test_radix_sort()
+{
+	for (int count : {0, 1, 2, 1000, 100000})
+		for (int threads : {1, 4})
+		{
+			std::vector<PersonWithChangedData> results = random_results(count, count + threads);
+			const std::vector<PersonWithChangedData> expected = std_sorted(results);
+			radix_sort_results(results, threads);
+			check(same_order(results, expected),
+				  "radix: " + std::to_string(count) + " results, threads = " + std::to_string(threads) + ", same order as std::sort");
+		}
+
+	// the keys are made from the bits of the ages and ids, so the edges of both ranges are the risky part
+	std::vector<PersonWithChangedData> edges;
+	for (double age : {-0.0, 0.0, -1e300, 1e300, -0.1, 0.1, -5e-324, 5e-324})
+		for (int id : {INT32_MIN, -1, 0, 1, INT32_MAX})
+			edges.push_back(make_result(id, age));
+	std::reverse(edges.begin(), edges.end());
+	const std::vector<PersonWithChangedData> expected = std_sorted(edges);
+	radix_sort_results(edges, 1);
+	check(same_order(edges, expected), "radix: extreme ages and ids, and -0.0 next to 0.0, same order as std::sort");
+}
+
+bool throws(const std::function<void()> &f)
+{
+	try
+	{
+		f();
+	}
+	catch (const std::exception &)
+	{
+		return true;
+	}
+	return false;
+}
+
+// Overwrites the bytes at offset of the file at path.
+void patch_file(const std::string &path, std::streamoff offset, const void *bytes, std::size_t size)
+{
+	std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+	f.seekp(offset);
+	f.write(static_cast<const char *>(bytes), size);
+}
+
+void test_checkpoint()
+{
+	const std::string path = (std::filesystem::temp_directory_path() / "lab1_regression_checkpoint.log").string();
+	const PersonTable table = numbered_table(10);
+	// rows 0-5 in a first run, even rows pass the filter
+	auto result_of = [](std::uint32_t row)
+	{ return make_result(row % 2 == 0 ? -(int)row - 1 : (int)row, row + 0.5); };
+
+	std::filesystem::remove(path);
+	check(load_checkpoint(path, table).valid_bytes == 0, "checkpoint: a missing log means nothing is done");
+
+	{
+		CheckpointWriter writer(path, table, 0, std::chrono::milliseconds(1));
+		for (std::uint32_t row = 0; row < 6; row++)
+			writer.record(row, result_of(row));
+		writer.record(2, result_of(2)); // a record finished twice counts once
+	}
+	ResumeState state = load_checkpoint(path, table);
+	const std::uint64_t first_run_bytes = sizeof(CheckpointHeader) + 7 * sizeof(CheckpointEntry);
+	check(state.valid_bytes == first_run_bytes && std::filesystem::file_size(path) == first_run_bytes,
+		  "checkpoint: the log is the header and one entry per record");
+	check(state.completed_count == 6 && state.completed == std::vector<bool>{1, 1, 1, 1, 1, 1, 0, 0, 0, 0},
+		  "checkpoint: resume marks exactly the logged rows done");
+	bool results_match = state.results.size() == 3;
+	for (const PersonWithChangedData &result : state.results)
+	{
+		const std::uint32_t row = result.originalData.id;
+		const PersonWithChangedData expected = result_of(row);
+		results_match = results_match && result.id == expected.id && result.age == expected.age && result.name == expected.name &&
+						result.originalData.name == table[row].name;
+	}
+	check(results_match, "checkpoint: resume restores the filtered results with their input rows");
+
+	{
+		std::ifstream in(path, std::ios::binary);
+		in.seekg(sizeof(CheckpointHeader));
+		CheckpointEntry entry;
+		bool tails_zero = true;
+		while (in.read(reinterpret_cast<char *>(&entry), sizeof(entry)))
+			for (std::size_t i = entry.name.size(); i <= entry.name.capacity(); i++)
+				tails_zero = tails_zero && entry.name.data()[i] == '\0';
+		check(tails_zero, "checkpoint: the unused tails of the names are written as zeros");
+	}
+
+	// a torn entry at the end is cut off and the log continues after the last whole one
+	{
+		std::ofstream torn(path, std::ios::binary | std::ios::app);
+		torn << "torn entry";
+	}
+	state = load_checkpoint(path, table);
+	check(state.valid_bytes == first_run_bytes && state.completed_count == 6, "checkpoint: a torn entry at the end is ignored");
+	{
+		CheckpointWriter writer(path, table, state.valid_bytes, std::chrono::milliseconds(1));
+		for (std::uint32_t row = 6; row < 10; row++)
+			writer.record(row, result_of(row));
+	}
+	state = load_checkpoint(path, table);
+	check(state.completed_count == 10 && state.results.size() == 5 && std::filesystem::file_size(path) == first_run_bytes + 4 * sizeof(CheckpointEntry),
+		  "checkpoint: a resumed run appends after the last whole entry");
+
+	PersonTable other = numbered_table(10);
+	other.push_back(10, 10, "p10");
+	check(throws([&]
+				 { load_checkpoint(path, other); }),
+		  "checkpoint: a log of another input is refused");
+
+	const std::uint32_t missing_row = 10;
+	patch_file(path, sizeof(CheckpointHeader), &missing_row, sizeof(missing_row));
+	check(throws([&]
+				 { load_checkpoint(path, table); }),
+		  "checkpoint: an entry for a row past the end is refused");
+
+	const std::uint32_t row = 0;
+	patch_file(path, sizeof(CheckpointHeader), &row, sizeof(row));
+	const std::uint8_t long_name = MODIFIED_NAME_LENGTH + 1;
+	patch_file(path, sizeof(CheckpointHeader) + sizeof(CheckpointEntry) - 1, &long_name, sizeof(long_name));
+	check(throws([&]
+				 { load_checkpoint(path, table); }),
+		  "checkpoint: an entry with a name longer than an entry holds is refused");
+
+	std::filesystem::remove(path);
+}
+
+// Same ids, ages and names in the same order.
+bool same_persons(const PersonTable &a, const PersonTable &b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (std::size_t r = 0; r < a.size(); r++)
+		if (a[r].id != b[r].id || a[r].age != b[r].age || a[r].name != b[r].name)
+			return false;
+	return true;
+}
+
+void write_file(const std::string &path, const std::string &content)
+{
+	std::ofstream(path, std::ios::binary) << content;
+}
+
+// Keeps the loaders' complaints about the broken files out of the report.
+class SilencedCerr
+{
+public:
+	SilencedCerr() : saved(std::cerr.rdbuf(nullptr))
+	{
+	}
+	~SilencedCerr()
+	{
+		std::cerr.rdbuf(saved);
+	}
+
+private:
+	std::streambuf *saved;
+};
+
+void test_loaders()
+{
+	const std::filesystem::path dir = std::filesystem::temp_directory_path();
+	const std::string bin = (dir / "lab1_regression_persons.bin").string();
+	const std::string jsonl = (dir / "lab1_regression_persons.jsonl").string();
+	const std::string json = (dir / "lab1_regression_persons.json").string();
+	SilencedCerr silenced;
+
+	PersonTable persons;
+	persons.push_back(1, 20.5, "Ann");
+	persons.push_back(-2, 0, "");
+	persons.push_back(INT32_MAX, -1.25, std::string(300, 'x'));
+	auto write_binary = [&](std::uint64_t header_count, std::size_t records)
+	{
+		std::ofstream out(bin, std::ios::binary);
+		write_persons_binary_header(out, header_count);
+		for (std::size_t r = 0; r < records; r++)
+			write_person_record(out, persons[r]);
+	};
+
+	write_binary(persons.size(), persons.size());
+	check(same_persons(load_persons_file(bin), persons), "binary: a written file loads back the same");
+	std::size_t chunked_rows = 0;
+	const bool chunks_read = read_persons_in_chunks(bin, 2, [&](PersonTable &&chunk)
+													{ chunked_rows += chunk.size(); });
+	check(chunks_read && chunked_rows == persons.size(), "binary: reading in chunks gives every record");
+
+	write_binary(persons.size() + 1, persons.size());
+	check(load_persons_file(bin).empty(), "binary: a count one past the records is refused");
+	write_binary(UINT64_C(1) << 60, persons.size());
+	check(load_persons_file(bin).empty() && !read_persons_in_chunks(bin, 2, [](PersonTable &&) {}),
+		  "binary: a count the file can't hold is refused before allocating");
+	write_binary(persons.size(), persons.size());
+	std::filesystem::resize_file(bin, std::filesystem::file_size(bin) - 1);
+	check(load_persons_file(bin).empty(), "binary: a truncated last record is refused");
+	write_file(bin, "PRSX");
+	check(load_persons_file(bin).empty(), "binary: a file without the header is refused");
+	write_file(bin, "");
+	check(load_persons_file(bin).empty(), "binary: an empty file is refused");
+
+	write_file(jsonl, "{\"age\": 20.5, \"id\": 1, \"name\": \"Ann\"}\n\n{\"age\": 0, \"id\": -2, \"name\": \"\"}\n");
+	PersonTable expected;
+	expected.push_back(persons[0]);
+	expected.push_back(persons[1]);
+	check(same_persons(load_persons_file(jsonl), expected), "jsonl: records load and blank lines are skipped");
+	write_file(jsonl, "{\"age\": 20.5, \"id\": 1, \"name\": \"Ann\"}\n{\"age\": 0, \"id\": -2,\n");
+	check(throws([&]
+				 { load_persons_file(jsonl); }),
+		  "jsonl: a cut off line is an error");
+	write_file(jsonl, "{\"age\": 20.5, \"name\": \"Ann\"}\n");
+	check(throws([&]
+				 { load_persons_file(jsonl); }),
+		  "jsonl: a record without an id is an error");
+	write_file(jsonl, "{\"age\": \"old\", \"id\": 1, \"name\": \"Ann\"}\n");
+	check(throws([&]
+				 { load_persons_file(jsonl); }),
+		  "jsonl: an age that isn't a number is an error");
+	check(throws([&]
+				 { read_persons_in_chunks(jsonl, 2, [](PersonTable &&) {}); }),
+		  "jsonl: reading in chunks reports the bad record too");
+
+	write_file(json, "[{\"age\": 20.5, \"id\": 1, \"name\": \"Ann\"}, {\"age\": 0, \"id\": -2, \"name\": \"\"}]");
+	check(same_persons(load_persons_file(json), expected), "json: an array of records loads");
+	write_file(json, "[{\"age\": 20.5, \"id\": 1, \"name\": \"Ann\"}, {\"age\": 0");
+	check(throws([&]
+				 { load_persons_file(json); }),
+		  "json: a cut off array is an error");
+
+	std::filesystem::remove(bin);
+	std::filesystem::remove(jsonl);
+	std::filesystem::remove(json);
+}
+
+int main()
+{
+	test_overflow_policies();
+	test_top_k();
+	test_radix_sort();
+	test_checkpoint();
+	test_loaders();
+
+	if (failures > 0)
+	{
+		std::cout << failures << " checks failed." << std::endl;
+		return 1;
+	}
+	std::cout << "All checks passed." << std::endl;
+	return 0;
+}
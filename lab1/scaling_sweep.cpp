@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Thread-scaling sweep: runs every program for 1 to --max-threads threads,
+// --repetitions times each, and reports the median wall time with speedup,
+// efficiency and the Karp-Flatt serial fraction against the 1-thread run.
+// A thread count that is slower than the one before it (by more than
+// --tolerance) is flagged as a scaling regression, like IP's 15 -> 16 thread
+// slowdown; up to --cores threads that fails the sweep with exit code 2.
+//
+// A program is "name[@dir]=command". {threads} in the command is replaced by
+// the thread count, which is also put in OMP_NUM_THREADS. The command runs in
+// dir (the current directory by default), with its output discarded.
+
+struct Program
+{
+	std::string name;
+	std::string dir;
+	std::string command;
+};
+
+struct SweepConfig
+{
+	std::vector<Program> programs;
+	int cores = std::max(1u, std::thread::hardware_concurrency()); // regressions above this many threads don't fail the sweep
+	int max_threads = 0; // 0 - twice the cores
+	int repetitions = 3;
+	double tolerance = 0.05; // slowdown a thread count may have over the previous one before it is flagged
+	std::string csv_file_name = "scaling_sweep.csv";
+	std::string summary_file_name = "scaling_sweep.txt";
+};
+
+const std::vector<Program> DEFAULT_PROGRAMS = {
+	{"lab1", "", "./lab1 --input filters_some.json --threads {threads}"},
+	{"lab1-2", "", "./lab1-2 --input filters_some.json"},
+	{"IP", "../IP", "build/IP 4 {threads}"}, // data set 4 is the one with a data file, the others are random
+};
+
+struct SweepPoint
+{
+	int threads;
+	std::vector<double> ms; // one per repetition
+	double median_ms = 0;
+	double min_ms = 0;
+	double max_ms = 0;
+	double speedup = 0;
+	double efficiency = 0;
+	double serial_fraction = 0; // Karp-Flatt, undefined for 1 thread
+	bool regression = false;	// slower than the previous thread count
+};
+
+bool parse_program(const std::string &spec, Program &program)
+{
+	const std::size_t equals = spec.find('=');
+	if (equals == std::string::npos || equals == 0 || equals + 1 == spec.size())
+		return false;
+	const std::string name = spec.substr(0, equals);
+	const std::size_t at = name.find('@');
+	program.name = name.substr(0, at);
+	program.dir = at == std::string::npos ? "" : name.substr(at + 1);
+	program.command = spec.substr(equals + 1);
+	return !program.name.empty();
+}
+
+// Splits the command on whitespace and fills in the thread count.
+std::vector<std::string> command_arguments(const std::string &command, int threads)
+{
+	std::vector<std::string> args;
+	std::stringstream ss(command);
+	std::string arg;
+	while (ss >> arg)
+	{
+		std::size_t at;
+		while ((at = arg.find("{threads}")) != std::string::npos)
+			arg.replace(at, 9, std::to_string(threads));
+		args.push_back(arg);
+	}
+	return args;
+}
+
+// Whether the program's executable exists, so missing programs are skipped
+// instead of failing every run.
+bool executable_found(const Program &program)
+{
+	const std::vector<std::string> args = command_arguments(program.command, 1);
+	if (args.empty())
+		return false;
+	if (args[0].find('/') == std::string::npos)
+		return true; // looked up in PATH by execvp
+	const std::string path = program.dir.empty() || args[0][0] == '/' ? args[0] : program.dir + "/" + args[0];
+	return ::access(path.c_str(), X_OK) == 0;
+}
+
+// Runs the program once on `threads` threads. Returns the wall time in ms, or
+// a negative value if it couldn't be started or didn't exit with 0.
+double run_once(const Program &program, int threads)
+{
+	const std::vector<std::string> args = command_arguments(program.command, threads);
+	std::vector<char *> argv;
+	for (const std::string &arg : args)
+		argv.push_back(const_cast<char *>(arg.c_str()));
+	argv.push_back(nullptr);
+
+	std::cout.flush();
+	const auto start = std::chrono::steady_clock::now();
+	const pid_t pid = ::fork();
+	if (pid == -1)
+		return -1;
+	if (pid == 0)
+	{
+		if (!program.dir.empty() && ::chdir(program.dir.c_str()) != 0)
+			::_exit(126);
+		::setenv("OMP_NUM_THREADS", std::to_string(threads).c_str(), 1);
+		const int null = ::open("/dev/null", O_WRONLY);
+		if (null != -1)
+		{
+			::dup2(null, STDOUT_FILENO);
+			::dup2(null, STDERR_FILENO);
+		}
+		::execvp(argv[0], argv.data());
+		::_exit(127);
+	}
+	int status = 0;
+	::waitpid(pid, &status, 0);
+	const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? ms : -1;
+}
+
+double median(std::vector<double> values)
+{
+	std::sort(values.begin(), values.end());
+	const std::size_t mid = values.size() / 2;
+	return values.size() % 2 == 1 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+}
+
+// Fills in everything but the times, against the 1-thread point.
+void compute_metrics(std::vector<SweepPoint> &points, double tolerance)
+{
+	for (SweepPoint &point : points)
+	{
+		point.median_ms = median(point.ms);
+		point.min_ms = *std::min_element(point.ms.begin(), point.ms.end());
+		point.max_ms = *std::max_element(point.ms.begin(), point.ms.end());
+	}
+	const double serial_ms = points[0].median_ms;
+	for (std::size_t i = 0; i < points.size(); i++)
+	{
+		SweepPoint &point = points[i];
+		const double p = point.threads;
+		point.speedup = serial_ms / point.median_ms;
+		point.efficiency = point.speedup / p;
+		// e = (1/S - 1/p) / (1 - 1/p): the serial fraction that would explain the speedup by Amdahl's law
+		point.serial_fraction = point.threads > 1 ? (1 / point.speedup - 1 / p) / (1 - 1 / p) : 0;
+		point.regression = i > 0 && point.median_ms > points[i - 1].median_ms * (1 + tolerance);
+	}
+}
+
+void print_table(const std::string &name, const std::vector<SweepPoint> &points, int cores, std::ostream &out)
+{
+	out << name << ":" << std::endl;
+	out << "| Threads |  Median ms |     Min ms |     Max ms | Speedup | Efficiency | Serial fraction |" << std::endl;
+	out << "|---------|------------|------------|------------|---------|------------|-----------------|" << std::endl;
+	for (std::size_t i = 0; i < points.size(); i++)
+	{
+		const SweepPoint &point = points[i];
+		out << "| " << std::setw(7) << point.threads << " | " << std::fixed << std::setprecision(1) << std::setw(10) << point.median_ms << " | "
+			<< std::setw(10) << point.min_ms << " | " << std::setw(10) << point.max_ms << " | " << std::setprecision(2) << std::setw(7) << point.speedup
+			<< " | " << std::setprecision(1) << std::setw(9) << 100 * point.efficiency << "% | ";
+		if (point.threads > 1)
+			out << std::setprecision(3) << std::setw(15) << point.serial_fraction;
+		else
+			out << std::setw(15) << "-";
+		out << " |";
+		if (point.regression)
+			out << " slower than " << points[i - 1].threads << " threads" << (point.threads > cores ? " (oversubscribed)" : "");
+		out << std::defaultfloat << std::endl;
+	}
+
+	const auto best = std::max_element(points.begin(), points.end(), [](const SweepPoint &a, const SweepPoint &b)
+									   { return a.speedup < b.speedup; });
+	out << "Best: " << std::fixed << std::setprecision(2) << best->speedup << "x at " << best->threads << " threads, "
+		<< std::setprecision(1) << 100 * best->efficiency << "% efficiency." << std::defaultfloat << std::endl;
+}
+
+void print_usage(const char *program)
+{
+	std::cerr << "Usage: " << program << " [--run name[@dir]=command]... [--cores N] [--max-threads N] [--repetitions N] [--tolerance <fraction>]"
+			  << " [--csv <file>] [--summary <file>]" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	SweepConfig config;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (i + 1 >= argc)
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+		if (arg == "--run")
+		{
+			Program program;
+			if (!parse_program(argv[++i], program))
+			{
+				print_usage(argv[0]);
+				return 1;
+			}
+			config.programs.push_back(program);
+		}
+		else if (arg == "--cores")
+			config.cores = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--max-threads")
+			config.max_threads = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--repetitions")
+			config.repetitions = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--tolerance")
+			config.tolerance = std::max(0.0, std::stod(argv[++i]));
+		else if (arg == "--csv")
+			config.csv_file_name = argv[++i];
+		else if (arg == "--summary")
+			config.summary_file_name = argv[++i];
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+	if (config.programs.empty())
+		config.programs = DEFAULT_PROGRAMS;
+	if (config.max_threads == 0)
+		config.max_threads = 2 * config.cores;
+	const int cores = config.cores;
+
+	std::ofstream csv(config.csv_file_name);
+	csv << "program,threads,repetitions,median_ms,min_ms,max_ms,speedup,efficiency,serial_fraction,regression" << std::endl;
+	std::stringstream summary;
+	summary << "Scaling sweep: 1.." << config.max_threads << " threads, " << config.repetitions << " repetitions, " << cores
+			<< " hardware threads, tolerance " << 100 * config.tolerance << "%." << std::endl;
+
+	bool failed = false;
+	int swept = 0;
+	std::vector<std::string> regressions;
+	for (const Program &program : config.programs)
+	{
+		if (!executable_found(program))
+		{
+			std::cout << "Skipping " << program.name << ": '" << program.command << "' not found"
+					  << (program.dir.empty() ? "" : " in '" + program.dir + "'") << "." << std::endl;
+			summary << std::endl
+					<< program.name << ": skipped, not found." << std::endl;
+			continue;
+		}
+
+		// the repetitions are the outer loop, so drift over time hits every thread count alike
+		std::vector<SweepPoint> points(config.max_threads);
+		for (int t = 0; t < config.max_threads; t++)
+			points[t].threads = t + 1;
+		bool program_failed = false;
+		for (int r = 0; r < config.repetitions && !program_failed; r++)
+		{
+			for (SweepPoint &point : points)
+			{
+				std::cout << "Running " << program.name << " on " << point.threads << " threads (" << r + 1 << "/" << config.repetitions << ")..." << std::endl;
+				const double ms = run_once(program, point.threads);
+				if (ms < 0)
+				{
+					std::cerr << program.name << " failed on " << point.threads << " threads." << std::endl;
+					program_failed = true;
+					break;
+				}
+				point.ms.push_back(ms);
+			}
+		}
+		if (program_failed)
+		{
+			failed = true;
+			summary << std::endl
+					<< program.name << ": failed." << std::endl;
+			continue;
+		}
+
+		compute_metrics(points, config.tolerance);
+		swept++;
+		for (std::size_t i = 0; i < points.size(); i++)
+		{
+			const SweepPoint &point = points[i];
+			csv << program.name << "," << point.threads << "," << point.ms.size() << "," << point.median_ms << "," << point.min_ms << "," << point.max_ms << ","
+				<< point.speedup << "," << point.efficiency << ",";
+			if (point.threads > 1)
+				csv << point.serial_fraction;
+			csv << "," << (point.regression ? 1 : 0) << std::endl;
+			if (point.regression && point.threads <= cores)
+			{
+				std::stringstream line;
+				line << program.name << ": " << point.threads << " threads take " << std::fixed << std::setprecision(1) << point.median_ms << " ms, "
+					 << 100 * (point.median_ms / points[i - 1].median_ms - 1) << "% more than " << points[i - 1].threads << " threads ("
+					 << points[i - 1].median_ms << " ms).";
+				regressions.push_back(line.str());
+			}
+		}
+		summary << std::endl;
+		print_table(program.name, points, cores, summary);
+	}
+
+	summary << std::endl;
+	if (regressions.empty())
+		summary << "No scaling regressions within " << cores << " hardware threads." << std::endl;
+	else
+	{
+		summary << "Scaling regressions within " << cores << " hardware threads:" << std::endl;
+		for (const std::string &line : regressions)
+			summary << "  " << line << std::endl;
+	}
+
+	std::cout << std::endl
+			  << summary.str();
+	std::ofstream(config.summary_file_name) << summary.str();
+	std::cout << "Results written to '" << config.csv_file_name << "' and '" << config.summary_file_name << "'." << std::endl;
+	if (failed || swept == 0)
+		return 1;
+	return regressions.empty() ? 0 : 2;
+}
@@ -0,0 +1,375 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "cancellation.hpp"
+#include "checkpoint.hpp"
+#include "engine.hpp"
+#include "person.hpp"
+#include "person_table.hpp"
+#include "topology.hpp"
+
+// Sharded execution over worker processes instead of threads. The coordinator
+// copies the table into one shared input segment and forks the workers; they
+// claim batches of records through an atomic cursor in that segment and
+// publish every finished record into a result segment of their own, which the
+// coordinator merges once they are gone. A worker that crashes takes only
+// itself down: whatever it published stays in its segment, and the records
+// it claimed but didn't finish are run again by a new round of workers.
+//
+// The segments are MAP_SHARED anonymous mappings made before the fork, so the
+// workers inherit them and nothing is left behind in /dev/shm. A result
+// segment is only touched by its worker, so with first-touch placement its
+// pages end up on that worker's NUMA node.
+
+// One MAP_SHARED anonymous mapping, seen by the process that made it and every
+// process it forks afterwards.
+class SharedSegment
+{
+public:
+	explicit SharedSegment(std::size_t size)
+	{
+		this->size = std::max<std::size_t>(size, 1);
+		memory = ::mmap(nullptr, this->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (memory == MAP_FAILED)
+			throw std::runtime_error("Couldn't map a shared segment of " + std::to_string(this->size) + " bytes.");
+	}
+
+	SharedSegment(const SharedSegment &) = delete;
+	SharedSegment &operator=(const SharedSegment &) = delete;
+
+	~SharedSegment()
+	{
+		::munmap(memory, size);
+	}
+
+	char *data() const
+	{
+		return static_cast<char *>(memory);
+	}
+
+private:
+	void *memory;
+	std::size_t size;
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "the cursors in the shared segments are used by several processes");
+
+namespace shard_detail
+{
+	inline std::size_t align_up(std::size_t offset, std::size_t alignment = alignof(std::max_align_t))
+	{
+		return (offset + alignment - 1) / alignment * alignment;
+	}
+}
+
+// The table as flat columns in a shared segment, plus the list of rows the
+// current round works on and the cursor the workers claim them through.
+class ShardInput
+{
+public:
+	explicit ShardInput(const PersonTable &data)
+	{
+		using shard_detail::align_up;
+		count = data.size();
+		std::size_t names_bytes = 0;
+		for (Person p : data)
+			names_bytes += p.name.size();
+
+		const std::size_t ids_at = align_up(sizeof(Header));
+		const std::size_t ages_at = align_up(ids_at + count * sizeof(std::int32_t));
+		const std::size_t offsets_at = align_up(ages_at + count * sizeof(double));
+		const std::size_t work_at = align_up(offsets_at + (count + 1) * sizeof(std::uint64_t));
+		const std::size_t names_at = align_up(work_at + count * sizeof(std::uint32_t));
+		segment = std::make_unique<SharedSegment>(names_at + names_bytes);
+
+		char *base = segment->data();
+		header = new (base) Header();
+		ids = reinterpret_cast<std::int32_t *>(base + ids_at);
+		ages = reinterpret_cast<double *>(base + ages_at);
+		offsets = reinterpret_cast<std::uint64_t *>(base + offsets_at);
+		work = reinterpret_cast<std::uint32_t *>(base + work_at);
+		names = base + names_at;
+
+		std::uint64_t offset = 0;
+		for (std::size_t row = 0; row < count; row++)
+		{
+			const Person p = data[row];
+			ids[row] = p.id;
+			ages[row] = p.age;
+			offsets[row] = offset;
+			std::memcpy(names + offset, p.name.data(), p.name.size());
+			offset += p.name.size();
+		}
+		offsets[count] = offset;
+	}
+
+	std::size_t size() const
+	{
+		return count;
+	}
+
+	Person row(std::size_t r) const
+	{
+		return Person{ids[r], ages[r], std::string_view(names + offsets[r], offsets[r + 1] - offsets[r])};
+	}
+
+	// Makes rows the work of the next round, handed out batch at a time.
+	// Only called while no worker is running.
+	void set_work(const std::vector<std::uint32_t> &rows, std::uint64_t batch)
+	{
+		std::copy(rows.begin(), rows.end(), work);
+		header->work_count = rows.size();
+		header->batch = std::max<std::uint64_t>(batch, 1);
+		header->cursor.store(0, std::memory_order_relaxed);
+	}
+
+	// Claims the next batch: positions [begin, end) of the work list, empty
+	// once everything is claimed.
+	std::pair<std::uint64_t, std::uint64_t> claim()
+	{
+		const std::uint64_t begin = header->cursor.fetch_add(header->batch, std::memory_order_relaxed);
+		if (begin >= header->work_count)
+			return {header->work_count, header->work_count};
+		return {begin, std::min(begin + header->batch, header->work_count)};
+	}
+
+	std::uint32_t work_row(std::uint64_t position) const
+	{
+		return work[position];
+	}
+
+private:
+	struct Header
+	{
+		std::atomic<std::uint64_t> cursor{0};
+		std::uint64_t work_count = 0;
+		std::uint64_t batch = 1;
+	};
+
+	std::unique_ptr<SharedSegment> segment;
+	std::size_t count;
+	Header *header;
+	std::int32_t *ids;
+	double *ages;
+	std::uint64_t *offsets; // names[offsets[r], offsets[r + 1]) is the name of row r
+	std::uint32_t *work;
+	char *names;
+};
+
+// Where one worker publishes its finished records, as checkpoint entries. An
+// entry is written before the count that covers it is released, so the
+// coordinator can trust every counted entry even if the worker died mid-way.
+class ShardResults
+{
+public:
+	explicit ShardResults(std::size_t capacity)
+	{
+		this->capacity = capacity;
+		segment = std::make_unique<SharedSegment>(shard_detail::align_up(sizeof(Header)) + capacity * sizeof(CheckpointEntry));
+		header = new (segment->data()) Header();
+		entries = reinterpret_cast<CheckpointEntry *>(segment->data() + shard_detail::align_up(sizeof(Header)));
+	}
+
+	// worker side
+	void publish(const CheckpointEntry &entry)
+	{
+		const std::uint64_t n = header->published.load(std::memory_order_relaxed);
+		if (n >= capacity)
+			throw std::runtime_error("ShardResults::publish: the result segment is full.");
+		entries[n] = entry;
+		header->published.store(n + 1, std::memory_order_release);
+	}
+
+	void set_elapsed_ms(double ms)
+	{
+		header->elapsed_ms = ms;
+	}
+
+	// coordinator side
+	std::uint64_t published() const
+	{
+		return header->published.load(std::memory_order_acquire);
+	}
+
+	const CheckpointEntry &operator[](std::uint64_t i) const
+	{
+		return entries[i];
+	}
+
+	// -1 if the worker didn't get to the end
+	double elapsed_ms() const
+	{
+		return header->elapsed_ms;
+	}
+
+private:
+	struct Header
+	{
+		std::atomic<std::uint64_t> published{0};
+		double elapsed_ms = -1;
+	};
+
+	std::unique_ptr<SharedSegment> segment;
+	std::size_t capacity;
+	Header *header;
+	CheckpointEntry *entries;
+};
+
+// The body of a worker process: claims batches until the work list is empty.
+// crash makes it abort after its first record, to try the recovery out.
+inline void run_shard_worker(ShardInput &input, ShardResults &output, int cpu, bool crash)
+{
+	const auto started = std::chrono::steady_clock::now();
+	if (!pin_current_thread(cpu))
+		std::cerr << "Worker process #" << ::getpid() << ": failed to pin to CPU " << cpu << "." << std::endl;
+	const CancellationToken never_cancelled;
+	while (true)
+	{
+		const auto [begin, end] = input.claim();
+		if (begin == end)
+			break;
+		for (std::uint64_t i = begin; i < end; i++)
+		{
+			const std::uint32_t row = input.work_row(i);
+			std::optional<PersonWithChangedData> p_changed = modify_person_data(input.row(row), never_cancelled);
+			output.publish(make_checkpoint_entry(row, *p_changed));
+			if (crash)
+				std::abort();
+		}
+	}
+	output.set_elapsed_ms(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count());
+}
+
+struct ShardReport
+{
+	std::vector<PersonWithChangedData> results; // records that passed the id filter, unsorted
+	int rounds = 0;
+	long crashed_workers = 0;
+	long rerun_records = 0; // claimed by a crashed worker and not published, so run again
+};
+
+// Runs the kernel over data on `processes` worker processes, batch records per
+// claim. Rounds of workers are started until every record is published or
+// max_rounds is reached, which is an error. crash_worker is the index of a
+// worker of the first round that aborts on purpose, -1 for none. cpus, if not
+// empty, has the CPU to pin every worker to.
+inline ShardReport run_sharded(const PersonTable &data, int processes, std::uint64_t batch, const std::vector<int> &cpus, std::ostream &out,
+							   int crash_worker = -1, int max_rounds = 3)
+{
+	ShardReport report;
+	ShardInput input(data);
+	std::vector<bool> done(data.size(), false);
+	std::vector<std::uint32_t> work(data.size());
+	for (std::size_t row = 0; row < data.size(); row++)
+		work[row] = row;
+
+	while (!work.empty() && report.rounds < max_rounds)
+	{
+		input.set_work(work, batch);
+		std::vector<std::unique_ptr<ShardResults>> outputs;
+		std::vector<pid_t> pids;
+		// the children inherit unflushed stream buffers and would print them again
+		out.flush();
+		std::cout.flush();
+		std::cerr.flush();
+		for (int i = 0; i < processes; i++)
+		{
+			outputs.push_back(std::make_unique<ShardResults>(work.size()));
+			const pid_t pid = ::fork();
+			if (pid == -1)
+			{
+				for (pid_t started : pids)
+					::waitpid(started, nullptr, 0);
+				throw std::runtime_error("Couldn't start worker process #" + std::to_string(i) + ".");
+			}
+			if (pid == 0)
+			{
+				int code = 0;
+				try
+				{
+					run_shard_worker(input, *outputs[i], cpus.empty() ? -1 : cpus[i % cpus.size()], report.rounds == 0 && i == crash_worker);
+				}
+				catch (const std::exception &e)
+				{
+					std::cerr << "Worker process #" << i << ": " << e.what() << std::endl;
+					code = 1;
+				}
+				std::cout.flush();
+				std::cerr.flush();
+				::_exit(code); // no destructors: the segments and the table belong to the coordinator
+			}
+			pids.push_back(pid);
+		}
+
+		for (int i = 0; i < processes; i++)
+		{
+			int status = 0;
+			::waitpid(pids[i], &status, 0);
+			if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+				out << "Worker process #" << i << " (pid " << pids[i] << "): " << outputs[i]->published() << " records in "
+					<< outputs[i]->elapsed_ms() << " ms." << std::endl;
+			else
+			{
+				report.crashed_workers++;
+				out << "Worker process #" << i << " (pid " << pids[i] << ") "
+					<< (WIFSIGNALED(status) ? "was killed by signal " + std::to_string(WTERMSIG(status)) : "exited with code " + std::to_string(WEXITSTATUS(status)))
+					<< " after " << outputs[i]->published() << " records." << std::endl;
+			}
+		}
+
+		// a record is taken from the first segment that has it
+		for (const auto &output : outputs)
+		{
+			const std::uint64_t published = output->published();
+			for (std::uint64_t e = 0; e < published; e++)
+			{
+				const CheckpointEntry &entry = (*output)[e];
+				if (done[entry.row])
+					continue;
+				done[entry.row] = true;
+				if (entry.id < 0)
+				{
+					PersonWithChangedData result;
+					result.originalData = data[entry.row];
+					result.id = entry.id;
+					result.age = entry.age;
+					result.name = entry.name;
+					report.results.push_back(result);
+				}
+			}
+		}
+		report.rounds++;
+
+		std::vector<std::uint32_t> left;
+		for (std::uint32_t row : work)
+			if (!done[row])
+				left.push_back(row);
+		work = std::move(left);
+		report.rerun_records += work.size();
+		if (!work.empty())
+			out << work.size() << " records weren't published, running them again." << std::endl;
+	}
+
+	if (!work.empty())
+		throw std::runtime_error(std::to_string(work.size()) + " records were still not processed after " + std::to_string(report.rounds) +
+								 " rounds of worker processes.");
+	return report;
+}
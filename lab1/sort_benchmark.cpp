@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "monitors.hpp"
+#include "radix_sort.hpp"
+
+// Compares the ways of putting results in age order: inserting into
+// SortedResultMonitor one by one, std::sort and the parallel radix sort.
+// Ages have one decimal, like the real data, so there are many ties.
+
+struct BenchmarkConfig
+{
+	int count = 1000000;
+	int insertion_limit = 50000; // insertion is O(n^2), larger inputs are skipped
+	int max_threads = std::max(1u, std::thread::hardware_concurrency());
+	unsigned seed = 42;
+};
+
+std::vector<PersonWithChangedData> make_results(int count, unsigned seed)
+{
+	std::mt19937 gen(seed);
+	std::uniform_int_distribution<int> age(0, 1000);
+	std::uniform_int_distribution<int> id(-1000000, -1);
+	std::vector<PersonWithChangedData> results(count);
+	for (auto &r : results)
+	{
+		r.age = age(gen) / 10.0;
+		r.id = id(gen);
+		r.name = "XXXXXXXXXXXXXXXXXXXXXXXXXXXXXX";
+	}
+	return results;
+}
+
+template <typename Body>
+double time_ms(Body body)
+{
+	const auto start = std::chrono::steady_clock::now();
+	body();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool same_order(const std::vector<PersonWithChangedData> &a, const std::vector<PersonWithChangedData> &b)
+{
+	return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const PersonWithChangedData &x, const PersonWithChangedData &y)
+					  { return x.age == y.age && x.id == y.id; });
+}
+
+void print_row(const std::string &method, double ms, int count)
+{
+	std::cout << "| " << std::setw(20) << std::left << method << std::right << " | " << std::fixed << std::setprecision(1) << std::setw(10) << ms
+			  << " | " << std::setprecision(1) << std::setw(12) << count / ms / 1000 << " |" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	BenchmarkConfig config;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--count" && i + 1 < argc)
+			config.count = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--insertion-limit" && i + 1 < argc)
+			config.insertion_limit = std::stoi(argv[++i]);
+		else if (arg == "--threads" && i + 1 < argc)
+			config.max_threads = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--seed" && i + 1 < argc)
+			config.seed = std::stoul(argv[++i]);
+		else
+		{
+			std::cerr << "Unknown argument '" << arg << "'. Usage: " << argv[0]
+					  << " [--count N] [--insertion-limit N] [--threads N] [--seed N]" << std::endl;
+			return 1;
+		}
+	}
+
+	const std::vector<PersonWithChangedData> input = make_results(config.count, config.seed);
+	std::cout << "Sorting " << config.count << " results." << std::endl;
+	std::cout << "| Method               |         ms | M results/s |" << std::endl;
+	std::cout << "|----------------------|------------|-------------|" << std::endl;
+
+	if (config.count <= config.insertion_limit)
+	{
+		SortedResultMonitor monitor(config.count);
+		const double ms = time_ms([&]
+								  {
+			for (auto &r : input)
+				monitor.addItemSorted(r); });
+		print_row("insertion (monitor)", ms, config.count);
+	}
+	else
+		std::cout << "| insertion (monitor)  |    skipped |             |" << std::endl;
+
+	std::vector<PersonWithChangedData> expected = input;
+	print_row("std::sort", time_ms([&]
+								   { std::sort(expected.begin(), expected.end(), Younger()); }),
+			  config.count);
+
+	bool ok = true;
+	for (int threads = 1; threads <= config.max_threads; threads *= 2)
+	{
+		std::vector<PersonWithChangedData> results = input;
+		const double ms = time_ms([&]
+								  { radix_sort_results(results, threads); });
+		print_row("radix, " + std::to_string(threads) + " thread(s)", ms, config.count);
+		ok = ok && same_order(results, expected);
+	}
+	if (!ok)
+	{
+		std::cerr << "Radix sort order differs from std::sort." << std::endl;
+		return 1;
+	}
+	return 0;
+}
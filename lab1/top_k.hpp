@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+#include "person.hpp"
+
+// Result order: younger first. Ties are broken by id, so which results make it
+// into a top K does not depend on thread timing.
+struct Younger
+{
+	bool operator()(const PersonWithChangedData &a, const PersonWithChangedData &b) const
+	{
+		if (a.age != b.age)
+			return a.age < b.age;
+		return a.id < b.id;
+	}
+};
+
+// The K smallest items (by `less`) out of everything pushed, kept in a max-heap
+// of at most K items: a push costs O(log K) and memory stays O(K) no matter how
+// many items go through. Not synchronized; threads keep one each and merge them.
+// Room for up to TOP_K_RESERVE items is made up front, the heap grows past
+// that only as items come, so a K larger than the input costs nothing extra.
+constexpr std::size_t TOP_K_RESERVE = 1024;
+
+template <typename T, typename Less>
+class TopK
+{
+public:
+	explicit TopK(std::size_t k, Less less = Less(), std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+		: heap(resource), less(less)
+	{
+		this->k = k;
+		heap.reserve(std::min(k, TOP_K_RESERVE));
+	}
+
+	// Returns false if the item is not among the K smallest so far.
+	bool push(const T &item)
+	{
+		if (heap.size() < k)
+		{
+			heap.push_back(item);
+			std::push_heap(heap.begin(), heap.end(), less);
+			return true;
+		}
+		if (k == 0 || !less(item, heap.front()))
+			return false;
+		// replace the largest kept item
+		std::pop_heap(heap.begin(), heap.end(), less);
+		heap.back() = item;
+		std::push_heap(heap.begin(), heap.end(), less);
+		return true;
+	}
+
+	void merge(const TopK &other)
+	{
+		for (auto &item : other.heap)
+			push(item);
+	}
+
+	// the kept items, smallest first
+	std::vector<T> sorted() const
+	{
+		std::vector<T> items(heap.begin(), heap.end());
+		std::sort(items.begin(), items.end(), less);
+		return items;
+	}
+
+	std::size_t size() const
+	{
+		return heap.size();
+	}
+
+	std::size_t capacity() const
+	{
+		return k;
+	}
+
+private:
+	std::pmr::vector<T> heap;
+	Less less;
+	std::size_t k;
+};
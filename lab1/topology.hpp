@@ -0,0 +1,239 @@
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+// CPU topology detection (from /sys/devices/system/cpu) and thread placement.
+
+struct CpuInfo
+{
+	int cpu;
+	int package;
+	int core;	   // core_id, unique only within a package
+	int smt_index; // 0 for the first hardware thread of a core, 1 for its sibling, ...
+};
+
+struct CpuTopology
+{
+	std::vector<CpuInfo> cpus; // only the CPUs this process is allowed to run on
+	int packages = 0;
+	std::set<int> package_ids; // as sysfs reports them: not always dense or from 0, and -1 on some kernels
+	int cores = 0;
+	bool from_sysfs = false;
+};
+
+enum class PlacementPolicy
+{
+	None,	 // leave placement to the scheduler
+	Compact, // fill one package (and its cores' SMT siblings) before the next
+	Scatter	 // spread threads over packages and cores first
+};
+
+inline bool parse_placement_policy(const std::string &name, PlacementPolicy &policy)
+{
+	if (name == "none")
+		policy = PlacementPolicy::None;
+	else if (name == "compact")
+		policy = PlacementPolicy::Compact;
+	else if (name == "scatter")
+		policy = PlacementPolicy::Scatter;
+	else
+		return false;
+	return true;
+}
+
+// Parses a sysfs CPU list such as "0-3,8-11".
+inline std::vector<int> parse_cpu_list(const std::string &list)
+{
+	std::vector<int> cpus;
+	std::stringstream ss(list);
+	std::string range;
+	while (std::getline(ss, range, ','))
+	{
+		if (range.empty() || range == "\n")
+			continue;
+		const size_t dash = range.find('-');
+		const int first = std::stoi(range.substr(0, dash));
+		const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+		for (int cpu = first; cpu <= last; cpu++)
+			cpus.push_back(cpu);
+	}
+	return cpus;
+}
+
+inline bool read_sysfs_int(const std::string &path, int &value)
+{
+	std::ifstream f(path);
+	return (bool)(f >> value);
+}
+
+inline CpuTopology detect_topology()
+{
+	CpuTopology topology;
+
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	const bool have_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+	std::vector<int> online;
+	{
+		std::ifstream f("/sys/devices/system/cpu/online");
+		std::string list;
+		if (std::getline(f, list))
+			online = parse_cpu_list(list);
+	}
+
+	topology.from_sysfs = !online.empty();
+	if (!topology.from_sysfs)
+	{
+		// no sysfs: assume one package with one hardware thread per core
+		const int count = std::max(1u, std::thread::hardware_concurrency());
+		for (int cpu = 0; cpu < count; cpu++)
+			online.push_back(cpu);
+	}
+
+	for (int cpu : online)
+	{
+		if (have_mask && !CPU_ISSET(cpu, &allowed))
+			continue;
+		CpuInfo info{cpu, 0, cpu, 0};
+		if (topology.from_sysfs)
+		{
+			const std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+			read_sysfs_int(base + "physical_package_id", info.package);
+			read_sysfs_int(base + "core_id", info.core);
+		}
+		topology.cpus.push_back(info);
+	}
+
+	// number the hardware threads of every core
+	std::map<std::pair<int, int>, int> threads_per_core;
+	for (auto &info : topology.cpus)
+	{
+		info.smt_index = threads_per_core[{info.package, info.core}]++;
+		topology.package_ids.insert(info.package);
+	}
+	topology.packages = topology.package_ids.size();
+	topology.cores = threads_per_core.size();
+	return topology;
+}
+
+inline void print_topology(const CpuTopology &topology, std::ostream &out)
+{
+	out << "CPU topology" << (topology.from_sysfs ? "" : " (sysfs unavailable, guessed)") << ": " << topology.packages << " package(s), "
+		<< topology.cores << " core(s), " << topology.cpus.size() << " usable hardware thread(s)." << std::endl;
+	for (int package : topology.package_ids)
+	{
+		out << "  package " << package << ":";
+		for (auto &info : topology.cpus)
+			if (info.package == package)
+				out << " " << info.cpu << (info.smt_index > 0 ? "*" : "");
+		out << std::endl;
+	}
+	out << "  (* - SMT sibling of an earlier CPU)" << std::endl;
+}
+
+// CPUs for `reserved` dedicated threads (one whole core each, e.g. the producer)
+// followed by CPUs for `count` workers. Workers never share a core with a
+// reserved thread; if there are more workers than CPUs, the list wraps around.
+// Returns an empty plan for PlacementPolicy::None.
+struct PlacementPlan
+{
+	std::vector<int> reserved_cpus;
+	std::vector<int> worker_cpus;
+};
+
+inline PlacementPlan plan_placement(const CpuTopology &topology, PlacementPolicy policy, int count, bool avoid_smt, int reserved = 0)
+{
+	PlacementPlan plan;
+	if (policy == PlacementPolicy::None || topology.cpus.empty())
+		return plan;
+
+	// rank every core inside its package, so scatter can interleave packages
+	std::map<std::pair<int, int>, int> core_rank;
+	{
+		std::map<int, int> next_rank;
+		std::vector<CpuInfo> by_core = topology.cpus;
+		std::sort(by_core.begin(), by_core.end(), [](const CpuInfo &a, const CpuInfo &b)
+				  { return std::tie(a.package, a.core) < std::tie(b.package, b.core); });
+		for (auto &info : by_core)
+			if (core_rank.find({info.package, info.core}) == core_rank.end())
+				core_rank[{info.package, info.core}] = next_rank[info.package]++;
+	}
+
+	std::vector<CpuInfo> order = topology.cpus;
+	if (policy == PlacementPolicy::Compact)
+		std::sort(order.begin(), order.end(), [](const CpuInfo &a, const CpuInfo &b)
+				  { return std::tie(a.package, a.core, a.smt_index) < std::tie(b.package, b.core, b.smt_index); });
+	else
+		std::sort(order.begin(), order.end(), [&](const CpuInfo &a, const CpuInfo &b)
+				  {
+					  const int rank_a = core_rank.at({a.package, a.core});
+					  const int rank_b = core_rank.at({b.package, b.core});
+					  return std::tie(a.smt_index, rank_a, a.package) < std::tie(b.smt_index, rank_b, b.package); });
+
+	// reserved threads take the first cores of the order, siblings included
+	std::set<std::pair<int, int>> reserved_cores;
+	for (auto &info : order)
+	{
+		if ((int)reserved_cores.size() == reserved)
+			break;
+		if (info.smt_index == 0 && reserved_cores.insert({info.package, info.core}).second)
+			plan.reserved_cpus.push_back(info.cpu);
+	}
+
+	std::vector<int> worker_order;
+	for (auto &info : order)
+	{
+		if (reserved_cores.count({info.package, info.core}) > 0)
+			continue;
+		if (avoid_smt && info.smt_index > 0)
+			continue;
+		worker_order.push_back(info.cpu);
+	}
+	// a machine too small to dedicate cores still gets every worker pinned somewhere
+	if (worker_order.empty())
+		for (auto &info : order)
+			if (!avoid_smt || info.smt_index == 0)
+				worker_order.push_back(info.cpu);
+
+	for (int i = 0; i < count; i++)
+		plan.worker_cpus.push_back(worker_order[i % worker_order.size()]);
+	return plan;
+}
+
+inline void print_placement(const PlacementPlan &plan, std::ostream &out, const std::string &reserved_name = "producer")
+{
+	if (plan.worker_cpus.empty() && plan.reserved_cpus.empty())
+	{
+		out << "Thread placement: left to the scheduler." << std::endl;
+		return;
+	}
+	out << "Thread placement:";
+	for (size_t i = 0; i < plan.reserved_cpus.size(); i++)
+		out << " " << reserved_name << "#" << i << "->" << plan.reserved_cpus[i];
+	for (size_t i = 0; i < plan.worker_cpus.size(); i++)
+		out << " worker#" << i << "->" << plan.worker_cpus[i];
+	out << std::endl;
+}
+
+// Pins the calling thread to one CPU; a negative cpu leaves it unpinned.
+inline bool pin_current_thread(int cpu)
+{
+	if (cpu < 0)
+		return true;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "cache_line.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// How a monitor waits for its condition (or for its lock).
+enum class WaitMode
+{
+	Block,		 // park on the condition variable straight away
+	SpinThenPark // spin for a while, then park
+};
+
+inline bool parse_wait_mode(const std::string &name, WaitMode &mode)
+{
+	if (name == "block")
+		mode = WaitMode::Block;
+	else if (name == "spin")
+		mode = WaitMode::SpinThenPark;
+	else
+		return false;
+	return true;
+}
+
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	_mm_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+struct WaitStats
+{
+	long spin_attempts = 0;	 // waits that started by spinning
+	long spin_successes = 0; // ... and ended without parking
+	long parks = 0;			 // waits that parked on the condition variable (or blocked on the mutex)
+	int spin_limit = 0;		 // the current, self-tuned spin budget
+};
+
+// Waiting policy shared by the monitors.
+//
+// With WaitMode::SpinThenPark a waiter drops the monitor lock and spins with a
+// pause instruction until the monitor's state version changes, for at most
+// spin_limit iterations, before parking on the condition variable. The limit
+// tunes itself like glibc's adaptive mutexes: it moves towards twice the number
+// of spins that successful waits needed and shrinks after every wait that had
+// to park anyway. Notifiers skip the condition variable (and its futex syscall)
+// while nobody is parked. On a single CPU spinning can never help, so the
+// strategy always parks there.
+class WaitStrategy
+{
+public:
+	explicit WaitStrategy(WaitMode mode = WaitMode::Block)
+	{
+		this->mode = std::thread::hardware_concurrency() > 1 ? mode : WaitMode::Block;
+	}
+
+	// Waits until pred() holds. The lock has to be held on entry and is held on exit.
+	template <typename Predicate>
+	void wait(std::unique_lock<std::mutex> &lock, std::condition_variable &cv, Predicate pred)
+	{
+		if (pred())
+			return;
+
+		if (mode == WaitMode::SpinThenPark)
+		{
+			const int limit = spin_limit.load(std::memory_order_relaxed);
+			spin_attempts.fetch_add(1, std::memory_order_relaxed);
+			int spins = 0;
+			while (spins < limit)
+			{
+				const unsigned seen = version.load(std::memory_order_acquire);
+				lock.unlock();
+				while (spins < limit && version.load(std::memory_order_relaxed) == seen)
+				{
+					cpu_relax();
+					spins++;
+				}
+				lock.lock();
+				if (pred())
+				{
+					spin_successes.fetch_add(1, std::memory_order_relaxed);
+					adapt(limit + (2 * spins - limit) / 8);
+					return;
+				}
+			}
+			adapt(limit - limit / 8);
+		}
+
+		// parked is only changed under the monitor lock, so a notifier that changed the
+		// state before this point is seen by pred(), and one that changes it later sees parked
+		parks.fetch_add(1, std::memory_order_relaxed);
+		parked.fetch_add(1);
+		cv.wait(lock, pred);
+		parked.fetch_sub(1);
+	}
+
+	// Locks the monitor mutex, spinning on try_lock first in SpinThenPark mode.
+	void lock(std::unique_lock<std::mutex> &lock)
+	{
+		if (lock.try_lock())
+			return;
+		if (mode == WaitMode::SpinThenPark)
+		{
+			const int limit = spin_limit.load(std::memory_order_relaxed);
+			spin_attempts.fetch_add(1, std::memory_order_relaxed);
+			for (int spins = 0; spins < limit; spins++)
+			{
+				cpu_relax();
+				if (lock.try_lock())
+				{
+					spin_successes.fetch_add(1, std::memory_order_relaxed);
+					adapt(limit + (2 * spins - limit) / 8);
+					return;
+				}
+			}
+			adapt(limit - limit / 8);
+		}
+		parks.fetch_add(1, std::memory_order_relaxed);
+		lock.lock();
+	}
+
+	// Has to be called after every state change, once the monitor lock is released.
+	void notify(std::condition_variable &cv)
+	{
+		version.fetch_add(1);
+		if (mode == WaitMode::Block || parked.load() > 0)
+			cv.notify_all();
+	}
+
+	WaitStats get_stats() const
+	{
+		WaitStats stats;
+		stats.spin_attempts = spin_attempts.load(std::memory_order_relaxed);
+		stats.spin_successes = spin_successes.load(std::memory_order_relaxed);
+		stats.parks = parks.load(std::memory_order_relaxed);
+		stats.spin_limit = spin_limit.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	WaitMode get_mode() const
+	{
+		return mode;
+	}
+
+private:
+	static constexpr int min_spin_limit = 16;
+	static constexpr int max_spin_limit = 16384;
+
+	void adapt(int new_limit)
+	{
+		spin_limit.store(std::clamp(new_limit, min_spin_limit, max_spin_limit), std::memory_order_relaxed);
+	}
+
+	WaitMode mode;
+	// spinners poll version, so nothing that waiters write lives on its line
+	alignas(cache_line_size) std::atomic<unsigned> version{0}; // bumped on every notify
+	alignas(cache_line_size) std::atomic<int> parked{0};
+	std::atomic<int> spin_limit{1024};
+	std::atomic<long> spin_attempts{0};
+	std::atomic<long> spin_successes{0};
+	std::atomic<long> parks{0};
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cache_line.hpp"
+
+namespace work_stealing_detail
+{
+	// The indices a thread still has to run, [begin, end).
+	struct Range
+	{
+		std::mutex mtx;
+		std::size_t begin = 0;
+		std::size_t end = 0;
+	};
+}
+
+// Runs body(thread, i) for every i in [0, count) on `threads` threads. Every
+// thread starts with an equal contiguous range and takes indices from its
+// front; a thread that runs out steals the back half of the largest range
+// left, so expensive indices don't leave the other threads idle. Returns the
+// number of steals.
+template <typename Body>
+long work_stealing_for(int threads, std::size_t count, Body body)
+{
+	using work_stealing_detail::Range;
+	std::vector<CachePadded<Range>> ranges(threads);
+	for (int t = 0; t < threads; t++)
+	{
+		ranges[t].value.begin = count * t / threads;
+		ranges[t].value.end = count * (t + 1) / threads;
+	}
+
+	std::vector<CachePadded<long>> steals(threads);
+	auto worker = [&](int t)
+	{
+		Range &own = ranges[t].value;
+		while (true)
+		{
+			std::size_t i = 0;
+			bool found = false;
+			{
+				std::lock_guard<std::mutex> lock(own.mtx);
+				if (own.begin < own.end)
+				{
+					i = own.begin++;
+					found = true;
+				}
+			}
+			if (found)
+			{
+				body(t, i);
+				continue;
+			}
+
+			// pick the victim with the most work left, then take the back half of its range
+			int victim = -1;
+			std::size_t most = 0;
+			for (int v = 0; v < threads; v++)
+			{
+				if (v == t)
+					continue;
+				std::lock_guard<std::mutex> lock(ranges[v].value.mtx);
+				const std::size_t left = ranges[v].value.end - ranges[v].value.begin;
+				if (left > most)
+				{
+					most = left;
+					victim = v;
+				}
+			}
+			if (victim == -1)
+				return; // nothing left anywhere
+
+			std::size_t stolen_begin, stolen_end;
+			{
+				Range &range = ranges[victim].value;
+				std::lock_guard<std::mutex> lock(range.mtx);
+				const std::size_t left = range.end - range.begin;
+				if (left == 0)
+					continue; // someone was faster, look again
+				stolen_end = range.end;
+				stolen_begin = range.end - (left + 1) / 2;
+				range.end = stolen_begin;
+			}
+			// own range is empty, so nobody steals from it while the victim's lock is released
+			{
+				std::lock_guard<std::mutex> lock(own.mtx);
+				own.begin = stolen_begin;
+				own.end = stolen_end;
+			}
+			steals[t].value++;
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (int t = 1; t < threads; t++)
+		workers.emplace_back(worker, t);
+	worker(0);
+	for (auto &w : workers)
+		w.join();
+
+	long total = 0;
+	for (auto &s : steals)
+		total += s.value;
+	return total;
+}